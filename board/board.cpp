@@ -154,6 +154,7 @@ Bitboard Board::slider_blockers(Bitboard sliders, Square s,
     return blockers;
 }
 
+template<bool Keys>
 void Board::put_piece(Piece p, Square s) {
     assert(is_ok(p) && is_ok(s));
     Bitboard sbb = square_bb(s);
@@ -167,11 +168,13 @@ void Board::put_piece(Piece p, Square s) {
     pieces_[pt] |= sbb;
     pieces_on_[s] = p;
     /* material_[c] += mg_value[pt]; */
-    mat_key_ += PCKEY_INDEX[c][pt];
-
-    key_ ^= ZOBRIST.psq[p][s];
+    if (Keys) {
+        mat_key_ += PCKEY_INDEX[c][pt];
+        key_ ^= ZOBRIST.psq[p][s];
+    }
 }
 
+template<bool Keys>
 void Board::remove_piece(Square s) {
     assert(is_ok(s));
     Bitboard sbb = square_bb(s);
@@ -185,11 +188,17 @@ void Board::remove_piece(Square s) {
     pieces_[pt] ^= sbb;
     pieces_on_[s] = NO_PIECE;
     /* material_[c] -= mg_value[pt]; */
-    mat_key_ -= PCKEY_INDEX[c][pt];
-
-    key_ ^= ZOBRIST.psq[p][s];
+    if (Keys) {
+        mat_key_ -= PCKEY_INDEX[c][pt];
+        key_ ^= ZOBRIST.psq[p][s];
+    }
 }
 
+template void Board::put_piece<true>(Piece p, Square s);
+template void Board::put_piece<false>(Piece p, Square s);
+template void Board::remove_piece<true>(Square s);
+template void Board::remove_piece<false>(Square s);
+
 
 Bitboard Board::pieces() const { return combined_; }
 Bitboard Board::pieces(Color c) const { return color_combined_[c]; }
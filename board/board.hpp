@@ -6,6 +6,21 @@
 #include <string_view>
 #include "../mininnue/nnue.hpp"
 
+// What unmake_move needs to take back a move, a third of a Board
+struct UndoInfo {
+    Bitboard checkers;
+    Bitboard blockers_for_king[COLOR_NB];
+    Bitboard pinners[COLOR_NB];
+    uint64_t key, mat_key;
+    StateInfo *si;
+
+    CastlingRights castling;
+    Square en_passant;
+    Piece captured;
+    uint8_t half_moves, plies_from_null;
+    uint16_t full_moves;
+};
+
 class Board {
 public:
     Board(StateInfo *si = nullptr);
@@ -30,6 +45,18 @@ public:
     [[nodiscard]] bool is_valid() const;
 
     Board do_move(Move m, StateInfo *newst = nullptr) const;
+    // do_move for perft: no NNUE deltas, no keys and no move counters
+    Board do_perft_move(Move m) const;
+
+    /*
+     * The same moves in place, to take back with unmake_move 
+     * and the record they fill. Copying a Board costs more than 
+     * the record on some CPUs and less on others, see perft_bench.
+     * */
+    void make_move(Move m, UndoInfo &u, StateInfo *newst = nullptr);
+    void make_perft_move(Move m, UndoInfo &u);
+    void unmake_move(Move m, const UndoInfo &u);
+
     Board do_null_move(StateInfo *newst = nullptr) const;
 
     /*
@@ -58,7 +85,10 @@ public:
     Bitboard slider_blockers(Bitboard sliders, Square s,
             Bitboard &pinners, Bitboard *checkers = nullptr) const;
 
+    // Keys: whether the zobrist and the material keys follow
+    template<bool Keys = true>
     void put_piece(Piece p, Square s);
+    template<bool Keys = true>
     void remove_piece(Square s);
 
     Bitboard pieces() const;
@@ -110,6 +140,10 @@ private:
     uint16_t full_moves_;
 
     StateInfo *si_;
+
+    template<bool Perft>
+    void apply_move(Move m, StateInfo *newst);
+    void save_undo(Move m, UndoInfo &u) const;
 };
 
 std::ostream& operator<<(std::ostream& os, const Board &b);
@@ -17,14 +17,98 @@ constexpr File rook_end(bool queenside) {
 
 Board Board::do_move(Move m, StateInfo *newst) const {
     Board result = *this;
+    result.apply_move<false>(m, newst);
+    return result;
+}
 
-    result.en_passant_ = SQ_NONE;
-    result.checkers_ = 0;
+Board Board::do_perft_move(Move m) const {
+    Board result = *this;
+    result.apply_move<true>(m, nullptr);
+    return result;
+}
+
+void Board::make_move(Move m, UndoInfo &u, StateInfo *newst) {
+    save_undo(m, u);
+    apply_move<false>(m, newst);
+}
+
+void Board::make_perft_move(Move m, UndoInfo &u) {
+    save_undo(m, u);
+    apply_move<true>(m, nullptr);
+}
+
+void Board::save_undo(Move m, UndoInfo &u) const {
+    u.checkers = checkers_;
+    for (Color c: { WHITE, BLACK }) {
+        u.blockers_for_king[c] = blockers_for_king_[c];
+        u.pinners[c] = pinners_[c];
+    }
+    u.key = key_;
+    u.mat_key = mat_key_;
+    u.si = si_;
+    u.castling = castling_;
+    u.en_passant = en_passant_;
+    u.captured = type_of(m) == EN_PASSANT ? make_piece(~side_to_move_, PAWN) 
+        : piece_on(to_sq(m));
+    u.half_moves = half_moves_;
+    u.plies_from_null = plies_from_null_;
+    u.full_moves = full_moves_;
+}
+
+// The pieces go back without the keys, which come back from the record with the rest
+void Board::unmake_move(Move m, const UndoInfo &u) {
+    Color us = ~side_to_move_;
+    Square from = from_sq(m), to = to_sq(m);
+
+    if (type_of(m) == CASTLING) {
+        Rank rank = rank_of(to);
+        bool queenside = file_of(to) == FILE_C;
+        remove_piece<false>(make_square(rook_end(queenside), rank));
+        put_piece<false>(make_piece(us, ROOK), make_square(rook_start(queenside), rank));
+    }
+
+    Piece moved = type_of(m) == PROMOTION ? make_piece(us, PAWN) : piece_on(to);
+    remove_piece<false>(to);
+    put_piece<false>(moved, from);
+
+    if (u.captured != NO_PIECE) {
+        put_piece<false>(u.captured, type_of(m) == EN_PASSANT 
+                ? make_square(file_of(to), rank_of(from)) : to);
+    }
+
+    checkers_ = u.checkers;
+    for (Color c: { WHITE, BLACK }) {
+        blockers_for_king_[c] = u.blockers_for_king[c];
+        pinners_[c] = u.pinners[c];
+    }
+    key_ = u.key;
+    mat_key_ = u.mat_key;
+    si_ = u.si;
+    castling_ = u.castling;
+    en_passant_ = u.en_passant;
+    half_moves_ = u.half_moves;
+    plies_from_null_ = u.plies_from_null;
+    full_moves_ = u.full_moves;
+    side_to_move_ = us;
+}
+
+// Perft: only what the move generator reads is kept up to date
+template<bool Perft>
+void Board::apply_move(Move m, StateInfo *newst) {
+    constexpr bool Keys = !Perft;
+    if (Perft)
+        newst = nullptr;
+
+    const CastlingRights old_castling = castling_;
+    const Square old_ep = en_passant_;
+
+    en_passant_ = SQ_NONE;
+    checkers_ = 0;
 
     if (newst) {
-        result.si_ = newst;
         newst->reset();
         newst->previous = si_;
+        si_ = newst;
     }
 
     Square from = from_sq(m), to = to_sq(m);
@@ -34,7 +118,7 @@ Board Board::do_move(Move m, StateInfo *newst) const {
              mbb = from_bb | to_bb;
     Piece moved = piece_on(from);
 
-    result.remove_piece(from);
+    remove_piece<Keys>(from);
 
     if (newst) {
         if (type_of(m) != PROMOTION) {
@@ -48,13 +132,13 @@ Board Board::do_move(Move m, StateInfo *newst) const {
 
     Piece captured = piece_on(to);
     if (captured != NO_PIECE) {
-        result.remove_piece(to);
+        remove_piece<Keys>(to);
         if (newst)
             newst->remove_piece(captured, to);
     }
     Piece p = type_of(m) == PROMOTION ? make_piece(
             us, prom_type(m)) : moved;
-    result.put_piece(p, to);
+    put_piece<Keys>(p, to);
 
     uint8_t disable_wks = (mbb & KINGSIDE_BB[WHITE]) != 0,
             disable_bks = (mbb & KINGSIDE_BB[BLACK]) != 0,
@@ -63,36 +147,35 @@ Board Board::do_move(Move m, StateInfo *newst) const {
     
     uint8_t cr_disabled = (disable_bqs << 3) | (disable_bks << 2)
         | (disable_wqs << 1) | disable_wks;
-    result.castling_ = CastlingRights(castling_ 
-            & (ALL_CASTLING ^ cr_disabled));
+    castling_ = CastlingRights(old_castling & (ALL_CASTLING ^ cr_disabled));
 
-    Bitboard ksq_bb = result.pieces(them, KING);
+    Bitboard ksq_bb = pieces(them, KING);
     Square ksq = lsb(ksq_bb);
 
     if (type_of(moved) == KNIGHT) {
-        result.checkers_ |= attacks_bb<KNIGHT>(ksq) & to_bb;
+        checkers_ |= attacks_bb<KNIGHT>(ksq) & to_bb;
     } else if (type_of(moved) == PAWN) {
         if (type_of(m) == EN_PASSANT) {
             Square cap_sq = make_square(file_of(to), rank_of(from));
-            result.remove_piece(cap_sq);
+            remove_piece<Keys>(cap_sq);
             if (newst)
                 newst->remove_piece(make_piece(them, PAWN), cap_sq);
-            result.checkers_ |= pawn_attacks_bb(them, ksq) & to_bb;
+            checkers_ |= pawn_attacks_bb(them, ksq) & to_bb;
         } else if (type_of(m) == PROMOTION) {
             PieceType prom = prom_type(m);
             if (prom == KNIGHT)
-                result.checkers_ |= attacks_bb<KNIGHT>(ksq) & to_bb;
+                checkers_ |= attacks_bb<KNIGHT>(ksq) & to_bb;
         } else if (from_bb & (RANK_2_BB | RANK_7_BB) 
                 && to_bb & (RANK_4_BB | RANK_5_BB)) 
         {
             Bitboard ep_bb = from_bb & RANK_2_BB;
             ep_bb |= to_bb & RANK_5_BB;
             ep_bb <<= 8;
-            result.en_passant_ = pop_lsb(ep_bb);
-            result.checkers_ |= pawn_attacks_bb(them, ksq) & to_bb;
+            en_passant_ = pop_lsb(ep_bb);
+            checkers_ |= pawn_attacks_bb(them, ksq) & to_bb;
         } else {
             assert(type_of(m) == NORMAL);
-            result.checkers_ |= pawn_attacks_bb(them, ksq) & to_bb;
+            checkers_ |= pawn_attacks_bb(them, ksq) & to_bb;
         }
     } else if (type_of(m) == CASTLING/* && type_of(moved) == KING*/) {
         Rank rank = rank_of(to);
@@ -101,40 +184,58 @@ Board Board::do_move(Move m, StateInfo *newst) const {
                rk_to = make_square(rook_end(queenside), rank);
         Piece rook = make_piece(us, ROOK);
 
-        result.remove_piece(rk_from);
-        result.put_piece(rook, rk_to);
+        remove_piece<Keys>(rk_from);
+        put_piece<Keys>(rook, rk_to);
         if (newst)
             newst->move_piece(rook, rk_from, rk_to);
+
+        mbb |= square_bb(rk_from) | square_bb(rk_to);
     }
 
-    result.blockers_for_king_[us] = result.slider_blockers<false>(
-            result.pieces(them), result.king_square(us),
-            result.pinners_[them]);
-    result.blockers_for_king_[them] = result.slider_blockers<true>(
-            result.pieces(us), result.king_square(them),
-            result.pinners_[us], &result.checkers_);
+    if (type_of(m) == EN_PASSANT)
+        mbb |= square_bb(make_square(file_of(to), rank_of(from)));
+
+    /*
+     * The pins and the slider checks of a king only change when a square
+     * on one of its lines changed, or when it moved itself. Otherwise they stay
+     * as they were: their king wasn't in check from our sliders before our move.
+     * */
+    if (type_of(moved) == KING || (mbb & attacks_bb<QUEEN>(king_square(us)))) {
+        blockers_for_king_[us] = slider_blockers<false>(
+                pieces(them), king_square(us),
+                pinners_[them]);
+    }
+    if (mbb & attacks_bb<QUEEN>(ksq)) {
+        blockers_for_king_[them] = slider_blockers<true>(
+                pieces(us), ksq,
+                pinners_[us], &checkers_);
+    }
 
-    result.side_to_move_ = them;
+    side_to_move_ = them;
+    if (Perft)
+        return;
 
     //this may possibly overflow only in quiescience
     //and there we don't care about half_moves
-    result.half_moves_++;
-    result.plies_from_null_++;
-    result.full_moves_ += side_to_move_ == BLACK;
+    half_moves_++;
+    plies_from_null_++;
+    full_moves_ += us == BLACK;
     if (type_of(moved) == PAWN || captured != NO_PIECE)
-        result.half_moves_ = 0;
+        half_moves_ = 0;
 
-    result.key_ ^= ZOBRIST.side
+    key_ ^= ZOBRIST.side
+        ^ ZOBRIST.castling[old_castling]
         ^ ZOBRIST.castling[castling_]
-        ^ ZOBRIST.castling[result.castling_]
+        ^ (ZOBRIST.enpassant[file_of(old_ep)] 
+            * (old_ep != SQ_NONE))
         ^ (ZOBRIST.enpassant[file_of(en_passant_)] 
-            * (en_passant_ != SQ_NONE))
-        ^ (ZOBRIST.enpassant[file_of(result.en_passant_)] 
-            * (result.en_passant_ != SQ_NONE));
+            * (en_passant_ != SQ_NONE));
 
-    return result;
+    // the fast path above against the full computation
+    assert(is_valid());
 }
 
+
 Board Board::do_null_move(StateInfo *newst) const {
     assert(!checkers_);
 
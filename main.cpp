@@ -3,14 +3,67 @@
 #include "selfplay.hpp"
 #include "pack.hpp"
 #include "tt.hpp"
+#include "perft.hpp"
+#include "movgen/generate.hpp"
+#include "mininnue/nnue.hpp"
+#include "mininnue/kernels.hpp"
 #include "primitives/utility.hpp"
+#include "primitives/perf.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <numeric>
+#include <random>
+#include <thread>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+static const char *bench_fens[] = {
+    #include "bench.csv"
+};
+
+// few pieces and kings on the move, so king bucket changes are frequent
+static const char *endgame_fens[] = {
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+    "8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+    "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+    "8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+    "8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1",
+    "8/R7/2q5/8/6k1/8/1P5p/K6R w - - 0 124",
+    "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+    "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+    "8/5k2/3p4/1p1Pp2p/pP2Pp1P/P4P1K/8/8 b - - 99 50",
+    "8/1k6/8/2p5/2P5/3K4/8/8 w - - 0 1",
+};
 
 static void run_bench(int argc, char **argv);
+static void run_endgame_bench();
+static void run_nnue_bench();
+static void run_nnue_ops_bench();
+static void run_update_cycles_bench();
+static void run_batch_eval_bench();
+static int run_int8_check();
+static int run_batch_eval_check();
+static void run_startup_bench();
+static void run_arch_bench();
+static void run_smp_bench(int max_threads);
+static void run_ttclear_bench(int mbs, int max_threads);
+static void run_tt_layout_bench(int mbs);
+static int run_tt_roundtrip(const char *path);
+static std::string temp_file_path();
 static void print_spsa();
 
 int main(int argc, char **argv) {
@@ -34,6 +87,7 @@ int main(int argc, char **argv) {
         int n_threads = atol(argv[7]);
         int tt_size = atol(argv[8]);
 
+        g_tt.set_threads(n_threads);
         g_tt.resize(tt_size);
 
         selfplay(out_name, num_pos, nodes, n_pv, max_ld_moves, n_threads);
@@ -85,6 +139,22 @@ int main(int argc, char **argv) {
         printf("Hash %llu\nNumber of chains %llu\nNumber of positions %llu\n",
                 cum_hash, n_chains, n_pos);
 
+        return 0;
+    } else if (!strcmp(argv[1], "packscore")) {
+        if (argc != 4 && argc != 5) {
+            printf("usage: packscore <pack_fin> <fout_txt> [n_threads]\n");
+            return 1;
+        }
+
+        int n_threads = argc == 5 ? atoi(argv[4]) : int(std::thread::hardware_concurrency());
+        double mean_error;
+        if (!score_packed_games(argv[2], argv[3], n_threads, &mean_error)) {
+            printf("failed to score %s\n", argv[2]);
+            return 1;
+        }
+
+        printf("%s: mean |eval - score| %.1f\n", mini::architecture_name(), mean_error);
+
         return 0;
     } else if (!strcmp(argv[1], "packmerge")) {
         if (argc < 3) {
@@ -125,6 +195,150 @@ int main(int argc, char **argv) {
     } else if (!strcmp(argv[1], "bench")) {
         run_bench(argc, argv);
         return 0;
+    } else if (!strcmp(argv[1], "ttstress")) {
+        if (argc > 4) {
+            printf("usage: ttstress [n_threads] [n_ops]\n");
+            return 1;
+        }
+
+        int n_threads = argc >= 3 ? atoi(argv[2]) : 8;
+        uint64_t n_ops = argc >= 4 ? atoll(argv[3]) : 10'000'000;
+        uint64_t n_hits = 0;
+
+        auto start = timer::now();
+        uint64_t n_corrupted = tt_stress_test(std::max(1, n_threads), n_ops, n_hits);
+        auto delta = timer::now() - start;
+
+        printf("%d threads, %llu ops each, %llu hits, %llu corrupted, %lld ms\n",
+                n_threads, (unsigned long long)n_ops, (unsigned long long)n_hits,
+                (unsigned long long)n_corrupted, (long long)delta);
+
+        return n_corrupted ? 1 : 0;
+    } else if (!strcmp(argv[1], "ttroundtrip")) {
+        if (argc > 3) {
+            printf("usage: ttroundtrip [tmp_file]\n");
+            return 1;
+        }
+
+        std::string path = argc == 3 ? argv[2] : temp_file_path();
+        if (path.empty()) {
+            printf("failed to create a temporary file\n");
+            return 1;
+        }
+
+        int result = run_tt_roundtrip(path.c_str());
+        std::remove(path.c_str());
+        return result;
+    } else if (!strcmp(argv[1], "perft")) {
+        if (argc > 5) {
+            printf("usage: perft [n_positions [threads [hash_mb]]]\n");
+            return 1;
+        }
+
+#if defined(USE_PEXT)
+        printf("slider attacks: pext, movegen %s\n", generator_name());
+#else
+        printf("slider attacks: magics, movegen %s\n", generator_name());
+#endif
+        return perft_bench(argc >= 3 ? atoi(argv[2]) : 1000, 
+                argc >= 4 ? std::max(1, atoi(argv[3])) : 1,
+                argc >= 5 ? size_t(std::max(0, atoi(argv[4]))) : 0) ? 1 : 0;
+    } else if (!strcmp(argv[1], "gencheck")) {
+        if (argc > 3) {
+            printf("usage: gencheck [depth]\n");
+            return 1;
+        }
+
+        return perft_check_generators(argc == 3 ? atoi(argv[2]) : 3) ? 1 : 0;
+    } else if (!strcmp(argv[1], "divide")) {
+        if (argc < 3 || argc > 6) {
+            printf("usage: divide <depth> [threads [hash_mb [fen]]]\n");
+            return 1;
+        }
+
+        Board b = Board::start_pos(nullptr);
+        if (argc == 6 && !b.load_fen(argv[5])) {
+            printf("invalid fen %s\n", argv[5]);
+            return 1;
+        }
+
+        const int depth = std::max(1, atoi(argv[2]));
+        const int n_threads = argc >= 4 ? std::max(1, atoi(argv[3])) : 1;
+        const size_t hash_mb = argc >= 5 ? size_t(std::max(0, atoi(argv[4]))) : 0;
+
+        std::vector<PerftDivide> divide;
+        auto start = std::chrono::steady_clock::now();
+        uint64_t nodes = perft(b, depth, n_threads, hash_mb, &divide);
+        double secs = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+
+        for (const PerftDivide &d: divide)
+            std::cout << d.move << ": " << d.nodes << '\n';
+        std::cout << "nodes " << nodes << " in " << std::fixed << std::setprecision(2) 
+            << secs << " s, " << nodes / secs * 1e-6 << " Mnps" << std::endl;
+        return 0;
+    } else if (!strcmp(argv[1], "nnuecheck")) {
+        if (argc > 3) {
+            printf("usage: nnuecheck [n_trials]\n");
+            return 1;
+        }
+
+        int n_trials = argc == 3 ? atoi(argv[2]) : 10'000;
+
+        // there's no trained net with hidden layers or with an output of each bucket to check them on
+        if (!mini::Architecture::LINEAR || mini::N_OUTPUT_BUCKETS > 1)
+            mini::load_random(0x5A7);
+
+        int total_errors = 0;
+        for (bool int8: { false, true }) {
+            const mini::Kernels *sets[4];
+            int n_sets = mini::supported_kernels(sets, int8);
+            for (int i = 0; i < n_sets; ++i) {
+                int n_errors = mini::check_kernels(*sets[i], n_trials, 0x5A7);
+                printf("%-15s kernels, %d trials, %d mismatches\n", 
+                        sets[i]->name, n_trials, n_errors);
+                total_errors += n_errors;
+            }
+        }
+
+        int n_errors = run_batch_eval_check();
+        total_errors += n_errors;
+
+        return total_errors ? 1 : 0;
+    } else if (!strcmp(argv[1], "convertnet")) {
+        if (argc != 3 && argc != 4) {
+            printf("usage: convertnet <out_raw> [compressed_in]\n");
+            return 1;
+        }
+
+        if (argc == 4 && !mini::load_compressed(argv[3])) {
+            printf("failed to load %s\n", argv[3]);
+            return 1;
+        }
+
+        if (!mini::save_raw(argv[2])) {
+            printf("failed to write %s\n", argv[2]);
+            return 1;
+        }
+
+        printf("%s written\n", argv[2]);
+        return 0;
+    } else if (!strcmp(argv[1], "randnet")) {
+        if (argc != 3 && argc != 4) {
+            printf("usage: randnet <out_raw> [seed]\n");
+            return 1;
+        }
+
+        if (!mini::load_random(argc == 4 ? strtoull(argv[3], nullptr, 0) : 0x5A7)
+                || !mini::save_raw(argv[2])) {
+            printf("failed to write %s\n", argv[2]);
+            return 1;
+        }
+
+        printf("%s written: %s\n", argv[2], mini::architecture_name());
+        return 0;
+    } else if (!strcmp(argv[1], "int8check")) {
+        return run_int8_check();
     } else if (!strcmp(argv[1], "spsa")) {
         print_spsa();
         return 0;
@@ -135,12 +349,50 @@ int main(int argc, char **argv) {
 }
 
 static void run_bench(int argc, char **argv) {
-    (void)(argc);
-    (void)(argv);
+    if (argc >= 3 && !strcmp(argv[2], "threads")) {
+        int max_threads = argc >= 4 ? atoi(argv[3]) 
+            : int(std::thread::hardware_concurrency());
+        run_smp_bench(std::max(1, max_threads));
+        return;
+    }
 
-    static const char *bench_fens[] = {
-        #include "bench.csv"
-    };
+    if (argc >= 3 && !strcmp(argv[2], "ttclear")) {
+        int mbs = argc >= 4 ? atoi(argv[3]) : 1024;
+        int max_threads = argc >= 5 ? atoi(argv[4]) 
+            : int(std::thread::hardware_concurrency());
+        run_ttclear_bench(std::max(1, mbs), std::max(1, max_threads));
+        return;
+    }
+
+    if (argc >= 3 && !strcmp(argv[2], "nnue")) {
+        if (argc >= 4 && !strcmp(argv[3], "int8"))
+            mini::use_int8(true);
+        std::cout << "kernels " << mini::kernels_name() << std::endl;
+        run_nnue_ops_bench();
+        run_nnue_bench();
+        run_update_cycles_bench();
+        run_batch_eval_bench();
+        return;
+    }
+
+    if (argc >= 3 && !strcmp(argv[2], "startup")) {
+        run_startup_bench();
+        return;
+    }
+
+    // the search bench below, for the architecture compiled in
+    if (argc >= 3 && !strcmp(argv[2], "arch"))
+        run_arch_bench();
+
+    if (argc >= 3 && !strcmp(argv[2], "endgame")) {
+        run_endgame_bench();
+        return;
+    }
+
+    if (argc >= 3 && !strcmp(argv[2], "tt")) {
+        run_tt_layout_bench(std::max(1, argc >= 4 ? atoi(argv[3]) : 64));
+        return;
+    }
 
     constexpr int N_FENS = std::size(bench_fens);
 
@@ -149,6 +401,7 @@ static void run_bench(int argc, char **argv) {
     int nps[N_FENS];
     Move best_moves[N_FENS];
     int scores[N_FENS];
+    TTStats tt_stats;
 
     std::unique_ptr<Search> search(new Search);
     search->set_silent(true);
@@ -168,13 +421,14 @@ static void run_bench(int argc, char **argv) {
 
         search->iterative_deepening();
 
-        auto stats = search->get_stats();
+        const SearchStats &stats = search->get_stats();
 
         nodes[i] = int(stats.nodes);
         times[i] = int(timer::now() - limits.start);
         nps[i] = 1000 * nodes[i] / std::max(1, times[i]);
         best_moves[i] = search->get_pv_start(0).move;
         scores[i] = search->get_pv_start(0).score;
+        tt_stats += stats.tt;
 
         g_tt.clear();
     }
@@ -191,12 +445,768 @@ static void run_bench(int argc, char **argv) {
     int64_t total_nodes = std::accumulate(std::begin(nodes), std::end(nodes), 0);
     int avg_nps = 1000 * total_nodes / std::accumulate(std::begin(times), std::end(times), 0);
 
+    std::cout << "\n" << tt_stats << '\n';
+
     std::cout << "\noverall " 
         << std::setw(9) << total_nodes << " nodes"
         << std::setw(9) << avg_nps << " nps" << std::endl;
 }
 
 
+static void run_endgame_bench() {
+    std::unique_ptr<Search> search(new Search);
+    search->set_silent(true);
+
+    SearchLimits limits;
+    limits.depth = 16;
+    limits.type = limits.DEPTH;
+
+    Board b;
+
+    for (bool cached: { false, true }) {
+        search->set_acc_cache(cached);
+
+        uint64_t total_nodes = 0, full = 0, from_cache = 0;
+        TimePoint total_time = 0;
+
+        for (const char *fen: endgame_fens) {
+            b.load_fen(fen);
+            g_tt.clear();
+            search->new_game();
+            search->setup(b, limits);
+
+            limits.start = timer::now();
+            search->iterative_deepening();
+            total_time += timer::now() - limits.start;
+
+            total_nodes += search->get_stats().nodes;
+            full += search->acc_cache().n_full;
+            from_cache += search->acc_cache().n_cached;
+        }
+
+        std::cout << (cached ? "cache on " : "cache off")
+            << " nodes "            << std::setw(9) << total_nodes
+            << " nps "              << std::setw(8) << 1000 * total_nodes / std::max<TimePoint>(1, total_time)
+            << " full refreshes "   << std::setw(7) << full
+            << " cached refreshes " << std::setw(7) << from_cache
+            << std::endl;
+    }
+}
+
+
+/*
+ * Each part of the eval on its own, over random moves made in random games 
+ * from the bench positions, and every castling move on the way, which is the only 
+ * 2a2s one: a refresh, a single-move update for each delta shape, the layers after 
+ * the transformer and evaluate of the position after the move with the one before 
+ * computed, as in search. Time per op and, with perf counters, cycles and cache misses 
+ * per op, so that a slower kernel shows up here and not only in the search bench.
+ * The accumulators of the samples fit in L2, like those near the top of the search stack.
+ * */
+static void run_nnue_ops_bench() {
+    constexpr int MAX_PLIES = 4;
+    constexpr int N_REPEATS = 200;
+
+    struct Sample {
+        StateInfo parent, child;
+        // after the move, on child
+        Board board;
+        // of the move, N_SHAPES when it changes a king bucket
+        int shape;
+    };
+
+    const mini::Net &net = mini::loaded_net();
+    const mini::Kernels &k = mini::active_kernels();
+
+    std::vector<std::unique_ptr<Sample>> samples;
+    auto add_sample = [&](const Board &b, Move m) {
+        auto s = std::make_unique<Sample>();
+        Board parent = b;
+        parent.set_stateinfo(&s->parent);
+        mini::refresh_accumulator(parent, s->parent.acc, WHITE);
+        mini::refresh_accumulator(parent, s->parent.acc, BLACK);
+        s->board = parent.do_move(m, &s->child);
+
+        int n_add = 0, n_sub = 0;
+        for (int i = 0; i < s->child.nb_deltas; ++i) {
+            n_add += s->child.deltas[i].to != SQ_NONE;
+            n_sub += s->child.deltas[i].from != SQ_NONE;
+        }
+        s->shape = mini::N_SHAPES;
+        for (int shape = 0; shape < mini::N_SHAPES; ++shape)
+            if (mini::SHAPE_ADDS[shape] == n_add && mini::SHAPE_SUBS[shape] == n_sub)
+                s->shape = shape;
+        for (Color c: { WHITE, BLACK })
+            if (!mini::update_accumulator(&s->child, c, s->board.king_square(c), 32))
+                s->shape = mini::N_SHAPES;
+
+        samples.push_back(std::move(s));
+    };
+
+    std::mt19937_64 rng(0x5A7);
+    for (const char *fen: bench_fens) {
+        Board b;
+        b.load_fen(fen);
+        for (int ply = 0; ply < MAX_PLIES; ++ply) {
+            ExtMove moves[MAX_MOVES];
+            ExtMove *end = generate<LEGAL>(b, moves);
+            if (end == moves)
+                break;
+
+            const Move m = moves[rng() % (end - moves)];
+            for (ExtMove *it = moves; it != end; ++it)
+                if (type_of(*it) == CASTLING || *it == m)
+                    add_sample(b, *it);
+            b = b.do_move(m);
+        }
+    }
+
+    PerfCounters perf;
+    if (!perf.available())
+        std::cout << "perf counters unavailable, time only" << std::endl;
+
+    // op runs every op once and returns how many it ran
+    auto measure = [&](const char *name, auto &&op) {
+        int32_t checksum = 0;
+        uint64_t n_ops = 0;
+
+        perf.start();
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < N_REPEATS; ++r)
+            n_ops += op(checksum);
+        double ns = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start).count();
+        PerfCounters::Counts counts = perf.stop();
+
+        std::cout << std::left << std::setw(12) << name << std::right
+            << " ops " << std::setw(6) << n_ops / N_REPEATS;
+        if (!n_ops) {
+            std::cout << " none among the samples" << std::endl;
+            return;
+        }
+
+        std::cout << " ns/op " << std::setw(7) << std::fixed << std::setprecision(1) << ns / n_ops;
+        if (perf.available()) {
+            std::cout << " cycles/op " << std::setw(7) << double(counts.cycles) / n_ops
+                << " misses/op " << std::setw(6) << std::setprecision(2) 
+                << double(counts.cache_misses) / n_ops;
+        }
+        std::cout << " checksum " << checksum << std::endl;
+    };
+
+    std::unique_ptr<mini::Accumulator> acc(new mini::Accumulator());
+    measure("refresh", [&](int32_t &checksum) {
+        for (auto &s: samples) {
+            for (Color c: { WHITE, BLACK })
+                mini::refresh_accumulator(s->board, *acc, c);
+            checksum += acc->psqt[WHITE];
+        }
+        return 2 * samples.size();
+    });
+
+    for (int shape = 0; shape < mini::N_SHAPES; ++shape) {
+        const std::string name = "update " + std::to_string(mini::SHAPE_ADDS[shape]) + "a"
+            + std::to_string(mini::SHAPE_SUBS[shape]) + "s";
+        measure(name.c_str(), [&](int32_t &checksum) {
+            size_t n = 0;
+            for (auto &s: samples) {
+                if (s->shape != shape)
+                    continue;
+                for (Color c: { WHITE, BLACK }) {
+                    s->child.acc.computed[c] = false;
+                    mini::update_accumulator(&s->child, c, s->board.king_square(c), 32);
+                }
+                checksum += s->child.acc.psqt[WHITE];
+                n += 2;
+            }
+            return n;
+        });
+    }
+
+    measure("forward", [&](int32_t &checksum) {
+        size_t n = 0;
+        for (auto &s: samples) {
+            if (s->shape == mini::N_SHAPES)
+                continue;
+            checksum += k.forward(net, s->child.acc, s->board.side_to_move(),
+                    mini::output_bucket(popcnt(s->board.pieces())));
+            ++n;
+        }
+        return n;
+    });
+
+    measure("evaluate", [&](int32_t &checksum) {
+        size_t n = 0;
+        for (auto &s: samples) {
+            if (s->shape == mini::N_SHAPES)
+                continue;
+            s->child.acc.computed[WHITE] = s->child.acc.computed[BLACK] = false;
+            checksum += mini::evaluate(s->board);
+            ++n;
+        }
+        return n;
+    });
+}
+
+// Random lines of a few plies from the bench positions, evaluated only at the end,
+// like qsearch does after a string of captures. The accumulators of the whole line
+// are caught up by a single update. Prints the time per evaluation for each line length.
+static void run_nnue_bench() {
+    constexpr int N_LINES = 200;
+    constexpr int N_REPEATS = 50;
+    constexpr int MAX_PLIES = 16;
+
+    std::mt19937_64 rng(0x5A7);
+
+    for (int n_plies: { 1, 2, 4, 8, 16 }) {
+        uint64_t n_evals = 0, n_moves = 0;
+        double total_ns = 0;
+        int32_t checksum = 0;
+
+        for (const char *fen: bench_fens) {
+            StateInfo states[MAX_PLIES + 1];
+            Board root(&states[0]);
+            root.load_fen(fen);
+
+            // pick the lines first, so that only do_move and evaluate are timed
+            std::vector<Move> lines;
+            for (int l = 0; l < N_LINES; ++l) {
+                Board b = root;
+                StateInfo si;
+                for (int ply = 0; ply < n_plies; ++ply) {
+                    ExtMove moves[MAX_MOVES];
+                    ExtMove *end = generate<LEGAL>(b, moves);
+                    Move m = end == moves ? MOVE_NONE : Move(moves[rng() % (end - moves)]);
+                    lines.push_back(m);
+                    if (m != MOVE_NONE)
+                        b = b.do_move(m, &si);
+                }
+            }
+
+            mini::refresh_accumulator(root, states[0].acc, WHITE);
+            mini::refresh_accumulator(root, states[0].acc, BLACK);
+
+            auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < N_REPEATS; ++r) {
+                const Move *m = lines.data();
+                for (int l = 0; l < N_LINES; ++l, m += n_plies) {
+                    Board b = root;
+                    for (int ply = 0; ply < n_plies && m[ply] != MOVE_NONE; ++ply, ++n_moves)
+                        b = b.do_move(m[ply], &states[ply + 1]);
+                    checksum += mini::evaluate(b);
+                    ++n_evals;
+                }
+            }
+            total_ns += std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start).count();
+        }
+
+        std::cout << "plies " << std::setw(2) << n_plies
+            << " evals "       << std::setw(7) << n_evals
+            << " ns/eval "     << std::setw(7) << std::fixed << std::setprecision(1) 
+                << total_ns / n_evals
+            << " ns/ply "      << std::setw(6) << total_ns / std::max<uint64_t>(1, n_moves)
+            << " checksum "    << checksum
+            << std::endl;
+    }
+}
+
+
+// evaluate_batch against evaluate on the bench positions
+static int run_batch_eval_check() {
+    constexpr int N_FENS = std::size(bench_fens);
+
+    std::vector<Board> boards(N_FENS);
+    int32_t batch[N_FENS];
+    for (int i = 0; i < N_FENS; ++i)
+        boards[i].load_fen(bench_fens[i]);
+
+    mini::evaluate_batch(boards.data(), N_FENS, batch, 2);
+
+    int n_errors = 0;
+    for (int i = 0; i < N_FENS; ++i) {
+        StateInfo si;
+        Board b(&si);
+        b.load_fen(bench_fens[i]);
+        n_errors += mini::evaluate(b) != batch[i];
+    }
+
+    printf("%-15s batch eval, %d positions, %d mismatches\n", 
+            mini::kernels_name(), N_FENS, n_errors);
+
+    return n_errors;
+}
+
+// Milliseconds from the embedded blob to a loaded net, with the old and the new decoder
+static void run_startup_bench() {
+    constexpr int N_RUNS = 20;
+
+    for (bool reference: { true, false }) {
+        double best_ms = 1e9, total_ms = 0;
+        for (int i = 0; i < N_RUNS; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            if (!mini::load_builtin(reference)) {
+                printf("failed to load the builtin net\n");
+                return;
+            }
+            double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+            best_ms = std::min(best_ms, ms);
+            total_ms += ms;
+        }
+
+        // FNV-1a over all the parameters, equal for a bit-exact decoder
+        const mini::Net &net = mini::loaded_net();
+        uint64_t hash = 0xcbf29ce484222325;
+        auto mix = [&](const int16_t *p, int n) {
+            for (int i = 0; i < n; ++i)
+                hash = (hash ^ uint16_t(p[i])) * 0x100000001b3;
+        };
+        mix(net.ft_weight, mini::N_FEATURES * mini::N_HIDDEN);
+        mix(net.ft_bias, mini::N_HIDDEN);
+        mix(net.ft_psqt, mini::N_FEATURES);
+        // a plain net has a single output, copied to every bucket
+        if (net.out_weight[0]) {
+            mix(net.out_weight[0][0], 2 * mini::N_HIDDEN);
+            mix(&net.out_bias[0], 1);
+        }
+
+        printf("%-8s decoder: best %6.2f ms, mean %6.2f ms, hash %016llx\n", 
+                reference ? "bitwise" : "word", best_ms, total_ms / N_RUNS, 
+                (unsigned long long)hash);
+    }
+}
+
+/*
+ * The compiled architecture, with random weights after the transformer unless it's 
+ * the default one, and the time the layers after the transformer take on the bench positions.
+ * Accuracy needs a trained net, packscore gives it on a dataset.
+ * */
+static void run_arch_bench() {
+    constexpr int N_REPEATS = 20'000;
+    constexpr int N_FENS = std::size(bench_fens);
+
+    if (!mini::Architecture::LINEAR && !mini::load_random(0x5A7)) {
+        printf("failed to load the builtin transformer\n");
+        return;
+    }
+
+    printf("architecture %s, hash %08x, %zu kB of parameters\n", mini::architecture_name(),
+            unsigned(mini::Architecture::HASH), sizeof(mini::NetParams) / 1024);
+
+    const mini::Net &net = mini::loaded_net();
+    const mini::Kernels &k = mini::active_kernels();
+
+    std::unique_ptr<mini::Accumulator[]> accs(new mini::Accumulator[N_FENS]);
+    Color stm[N_FENS];
+    int buckets[N_FENS];
+    for (int i = 0; i < N_FENS; ++i) {
+        Board b;
+        b.load_fen(bench_fens[i]);
+        mini::refresh_accumulator(b, accs[i], WHITE);
+        mini::refresh_accumulator(b, accs[i], BLACK);
+        stm[i] = b.side_to_move();
+        buckets[i] = mini::output_bucket(popcnt(b.pieces()));
+    }
+
+    int32_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < N_REPEATS; ++r)
+        for (int i = 0; i < N_FENS; ++i)
+            checksum += k.forward(net, accs[i], stm[i], buckets[i]);
+    double ns = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "kernels " << k.name 
+        << " ns/forward " << std::fixed << std::setprecision(1) << ns / (N_REPEATS * N_FENS)
+        << " checksum " << checksum << std::endl;
+
+    run_nnue_bench();
+}
+
+// Evaluates the bench positions with the int16 and the quantised int8 weights,
+// fails when the error is beyond about twice what the default net gives (mean 12, max 35)
+static int run_int8_check() {
+    constexpr int N_FENS = std::size(bench_fens);
+    constexpr double MAX_MEAN_ERROR = 24;
+    constexpr int MAX_ERROR = 72;
+
+    int32_t evals[N_FENS][2];
+    for (bool int8: { false, true }) {
+        mini::use_int8(int8);
+        for (int i = 0; i < N_FENS; ++i) {
+            StateInfo si;
+            Board b(&si);
+            b.load_fen(bench_fens[i]);
+            evals[i][int8] = mini::evaluate(b);
+        }
+    }
+    mini::use_int8(false);
+
+    int max_error = 0, max_i = 0;
+    double sum_error = 0, sum_abs = 0;
+    for (int i = 0; i < N_FENS; ++i) {
+        int error = std::abs(evals[i][0] - evals[i][1]);
+        if (error > max_error)
+            max_error = error, max_i = i;
+        sum_error += error;
+        sum_abs += std::abs(evals[i][0]);
+    }
+
+    const mini::Net &net = mini::loaded_net();
+    printf("scales: transformer %d, output %d\n", net.ft_scale, net.out_scale);
+    printf("%d positions, mean |eval| %.1f, mean error %.2f, max error %d (%s)\n", 
+            N_FENS, sum_abs / N_FENS, sum_error / N_FENS, max_error, bench_fens[max_i]);
+
+    if (sum_error / N_FENS > MAX_MEAN_ERROR || max_error > MAX_ERROR) {
+        printf("error beyond the bounds: mean %.1f, max %d\n", MAX_MEAN_ERROR, MAX_ERROR);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+// Positions without StateInfo chains, as in a dataset: evaluate refreshing each one 
+// vs evaluate_batch, for the positions of random games in order and shuffled
+static void run_batch_eval_bench() {
+    constexpr int N_GAMES = 100;
+    constexpr int MAX_PLIES = 24;
+
+    std::mt19937_64 rng(0x5A7);
+    std::vector<Board> boards;
+    for (const char *fen: bench_fens) {
+        Board root;
+        root.load_fen(fen);
+        for (int g = 0; g < N_GAMES; ++g) {
+            Board b = root;
+            for (int ply = 0; ply < MAX_PLIES; ++ply) {
+                ExtMove moves[MAX_MOVES];
+                ExtMove *end = generate<LEGAL>(b, moves);
+                if (end == moves)
+                    break;
+                b = b.do_move(moves[rng() % (end - moves)]);
+                boards.push_back(b);
+            }
+        }
+    }
+
+    const int n = int(boards.size());
+    std::vector<int32_t> single(n), batch(n);
+
+    for (bool shuffled: { false, true }) {
+        if (shuffled)
+            std::shuffle(boards.begin(), boards.end(), rng);
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i) {
+            StateInfo si;
+            Board b = boards[i];
+            b.set_stateinfo(&si);
+            single[i] = mini::evaluate(b);
+        }
+        double single_ns = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        mini::evaluate_batch(boards.data(), n, batch.data());
+        double batch_ns = std::chrono::duration<double, std::nano>(
+                std::chrono::steady_clock::now() - start).count();
+
+        std::cout << (shuffled ? "shuffled " : "in order ") << n << " positions:"
+            << " evaluate ns/pos " << std::fixed << std::setprecision(1) << single_ns / n
+            << " evaluate_batch ns/pos " << batch_ns / n
+            << (single == batch ? " equal" : " MISMATCH")
+            << std::endl;
+    }
+}
+
+// Cycles per single-move accumulator update for every delta shape:
+// the old copy + generic update, the chain kernel with one ply and the fused kernel
+static void run_update_cycles_bench() {
+    constexpr int N_SETS = 4096;
+    constexpr int N_ITERS = 1'000'000;
+
+    const mini::Net &net = mini::loaded_net();
+    const mini::Kernels &k = mini::active_kernels();
+
+    std::mt19937_64 rng(0x5A7);
+    std::vector<uint16_t> features(4 * N_SETS);
+    for (uint16_t &f: features)
+        f = uint16_t(rng() % mini::N_FEATURES);
+
+    std::unique_ptr<mini::Accumulator[]> accs(new mini::Accumulator[2]);
+    mini::Accumulator &src = accs[0], &dst = accs[1];
+    mini::Accumulator *dst_ptr = &dst;
+    mini::refresh_accumulator(Board::start_pos(nullptr), src, WHITE);
+
+    auto measure = [&](auto &&update) {
+        uint64_t start = __rdtsc();
+        for (int i = 0; i < N_ITERS; ++i) {
+            const uint16_t *f = &features[4 * (i % N_SETS)];
+            update(f, f + 2);
+        }
+        return double(__rdtsc() - start) / N_ITERS;
+    };
+
+    for (int shape = 0; shape < mini::N_SHAPES; ++shape) {
+        const int n_add = mini::SHAPE_ADDS[shape], n_sub = mini::SHAPE_SUBS[shape];
+
+        double generic = measure([&](const uint16_t *add, const uint16_t *sub) {
+            memcpy(dst.v[WHITE], src.v[WHITE], sizeof(dst.v[WHITE]));
+            dst.psqt[WHITE] = src.psqt[WHITE];
+            k.update_acc(net, dst, mini::FtSpan((uint16_t*)add, (uint16_t*)add + n_add),
+                    mini::FtSpan((uint16_t*)sub, (uint16_t*)sub + n_sub), WHITE);
+        });
+
+        double chain = measure([&](const uint16_t *add, const uint16_t *sub) {
+            mini::FtSpan a((uint16_t*)add, (uint16_t*)add + n_add);
+            mini::FtSpan s((uint16_t*)sub, (uint16_t*)sub + n_sub);
+            k.update_chain(net, src, &dst_ptr, &a, &s, 1, WHITE);
+        });
+
+        double fused = measure([&](const uint16_t *add, const uint16_t *sub) {
+            k.update_fused[shape](net, src, dst, add, sub, WHITE);
+        });
+
+        std::cout << n_add << "a" << n_sub << "s cycles/update:"
+            << " copy+generic " << std::setw(6) << std::fixed << std::setprecision(1) << generic
+            << " chain "        << std::setw(6) << chain
+            << " fused "        << std::setw(6) << fused
+            << std::endl;
+    }
+}
+
+
+static void run_smp_bench(int max_threads) {
+    SearchWorker worker;
+    worker.set_silent(true);
+
+    SearchLimits limits;
+    limits.depth = 13;
+    limits.type = limits.DEPTH;
+
+    Board b;
+    int64_t single_nps = 0;
+
+    for (int n = 1; ; n = std::min(2 * n, max_threads)) {
+        worker.set_threads(n);
+
+        uint64_t total_nodes = 0;
+        TimePoint total_time = 0;
+
+        for (const char *fen: bench_fens) {
+            b.load_fen(fen);
+            g_tt.clear();
+            worker.new_game();
+
+            limits.start = timer::now();
+            worker.go(b, limits);
+            worker.wait_for_completion();
+
+            total_time += timer::now() - limits.start;
+            total_nodes += worker.main_search().total_nodes();
+        }
+
+        int64_t nps = 1000 * int64_t(total_nodes) / std::max<TimePoint>(1, total_time);
+        if (n == 1)
+            single_nps = nps;
+
+        std::cout << "threads " << std::setw(3) << n
+            << " nodes "    << std::setw(10) << total_nodes
+            << " time "     << std::setw(7) << total_time
+            << " nps "      << std::setw(9) << nps
+            << " speedup "  << std::setprecision(3) << float(nps) / std::max<int64_t>(1, single_nps)
+            << std::endl;
+
+        if (n == max_threads)
+            break;
+    }
+}
+
+
+static void run_ttclear_bench(int mbs, int max_threads) {
+    constexpr int N_CLEARS = 5;
+
+    for (int n = 1; ; n = std::min(2 * n, max_threads)) {
+        g_tt.set_threads(n);
+
+        TimePoint start = timer::now();
+        g_tt.resize(mbs);
+        TimePoint resize_time = timer::now() - start;
+
+        start = timer::now();
+        for (int i = 0; i < N_CLEARS; ++i)
+            g_tt.clear();
+        float clear_time = float(timer::now() - start) / N_CLEARS;
+
+        std::cout << "threads "  << std::setw(3) << n
+            << " resize "        << std::setw(6) << resize_time << " ms"
+            << " clear "         << std::setw(8) << clear_time << " ms"
+            << " clear per GB "  << std::setw(8) << clear_time * 1024 / mbs << " ms"
+            << std::endl;
+
+        if (n == max_threads)
+            break;
+    }
+}
+
+
+// Fills a table with 4x its capacity of random keys over several "searches",
+// then probes the keys of the last search and as many keys that were never stored.
+// Every hit on a fresh key is a false hit the search would have to filter out.
+template<typename Bucket>
+static void tt_layout_bench(const char *name, int mbs) {
+    constexpr int N_SEARCHES = 8;
+
+    TranspositionTable<Bucket> tt;
+    tt.resize(mbs);
+
+    const uint64_t n_slots = uint64_t(mbs) * 1024 * 1024 / sizeof(Bucket) * Bucket::N;
+    const uint64_t n_keys = 4 * n_slots;
+    const uint64_t per_search = n_keys / N_SEARCHES;
+
+    std::mt19937_64 rng(0x5A7);
+    std::vector<uint64_t> recent(per_search);
+    // search trees are mostly shallow nodes, so is the depth distribution here
+    std::geometric_distribution<int> depth_dist(0.3);
+
+    TTStats stats;
+    for (int s = 0; s < N_SEARCHES; ++s) {
+        tt.new_search();
+        for (uint64_t i = 0; i < per_search; ++i) {
+            uint64_t key = rng();
+            recent[i] = key;
+            int depth = std::min(1 + depth_dist(rng), 60);
+            stats.record(tt.store(key, int16_t(key >> 16) % 2000, 0, BOUND_EXACT, 
+                        depth, Move(uint16_t(key >> 32)), 0, false));
+        }
+    }
+
+    TTEntry e;
+    uint64_t hits = 0, wrong = 0, false_hits = 0;
+
+    TimePoint start = timer::now();
+    for (uint64_t key: recent) {
+        if (tt.probe(key, e)) {
+            ++hits;
+            wrong += e.move16 != uint16_t(key >> 32);
+        }
+    }
+    for (uint64_t i = 0; i < per_search; ++i)
+        false_hits += tt.probe(rng(), e);
+    TimePoint probe_time = std::max<TimePoint>(1, timer::now() - start);
+
+    std::cout << std::fixed << std::setprecision(2)
+        << std::setw(8) << name << ' ' << sizeof(Bucket) / Bucket::N << " B/entry"
+        << " retained " << std::setw(5) << 100.0 * hits / per_search << '%'
+        << " wrong " << std::setw(7) << wrong
+        << " false hits per 1M probes " << std::setw(8) << 1e6 * false_hits / per_search
+        << " Mprobes/s " << std::setw(5) << 2.0 * per_search / probe_time / 1000
+        << '\n' << std::setw(8) << ' ' << ' ' << stats << '\n';
+}
+
+// Search NPS of a layout is measured by plain bench on a build with that layout
+static void run_tt_layout_bench(int mbs) {
+    tt_layout_bench<CompactBucket>("compact", mbs);
+    tt_layout_bench<WideBucket>("wide", mbs);
+
+#if defined(TT_WIDE_BUCKETS)
+    std::cout << "search uses the wide layout" << std::endl;
+#else
+    std::cout << "search uses the compact layout" << std::endl;
+#endif
+}
+
+
+// A fresh file for the roundtrip, empty on failure
+static std::string temp_file_path() {
+#if defined(__unix__) || defined(__APPLE__)
+    const char *dir = getenv("TMPDIR");
+    std::string path = std::string(dir && *dir ? dir : "/tmp") + "/saturn-XXXXXX";
+    int fd = mkstemp(path.data());
+    if (fd < 0)
+        return {};
+    close(fd);
+    return path;
+#else
+    char buf[L_tmpnam];
+    return std::tmpnam(buf) ? buf : std::string();
+#endif
+}
+
+// Searches a few positions, saves the TT, wipes it, loads it back 
+// and checks that hashfull and the PVs are the same
+static int run_tt_roundtrip(const char *path) {
+    constexpr int N_FENS = 8;
+    constexpr int PV_LEN = 32;
+
+    std::unique_ptr<Search> search(new Search);
+    search->set_silent(true);
+
+    SearchLimits limits;
+    limits.depth = 12;
+    limits.type = limits.DEPTH;
+
+    Board boards[N_FENS];
+    Move pvs[N_FENS][PV_LEN];
+    int pv_lens[N_FENS];
+
+    g_tt.clear();
+    search->new_game();
+
+    for (int i = 0; i < N_FENS; ++i) {
+        boards[i].load_fen(bench_fens[i]);
+        search->setup(boards[i], limits);
+        limits.start = timer::now();
+        search->iterative_deepening();
+    }
+
+    uint64_t hashfull = g_tt.hashfull();
+    for (int i = 0; i < N_FENS; ++i)
+        pv_lens[i] = g_tt.extract_pv(boards[i], pvs[i], PV_LEN);
+
+    TimePoint start = timer::now();
+    if (!g_tt.save(path)) {
+        printf("failed to save the hash to %s\n", path);
+        return 1;
+    }
+    TimePoint save_time = timer::now() - start;
+
+    g_tt.clear();
+    g_tt.new_search();
+
+    start = timer::now();
+    if (!g_tt.load(path)) {
+        printf("failed to load the hash from %s\n", path);
+        return 1;
+    }
+    TimePoint load_time = timer::now() - start;
+
+    int n_errors = 0;
+    if (g_tt.hashfull() != hashfull) {
+        printf("hashfull mismatch: %llu before, %llu after\n",
+                (unsigned long long)hashfull, (unsigned long long)g_tt.hashfull());
+        ++n_errors;
+    }
+
+    for (int i = 0; i < N_FENS; ++i) {
+        Move pv[PV_LEN];
+        int len = g_tt.extract_pv(boards[i], pv, PV_LEN);
+        if (len != pv_lens[i] || !std::equal(pv, pv + len, pvs[i])) {
+            printf("pv mismatch for %s\n", bench_fens[i]);
+            ++n_errors;
+        }
+    }
+
+    printf("hashfull %llu, saved in %lld ms, loaded in %lld ms, %d errors\n",
+            (unsigned long long)hashfull, (long long)save_time, 
+            (long long)load_time, n_errors);
+
+    return n_errors ? 1 : 0;
+}
+
+
 static void print_spsa() {
     for (int i = 0; i < params::registry.n_params; ++i) {
         const params::Parameter& p = params::registry.params[i];
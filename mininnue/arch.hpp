@@ -0,0 +1,173 @@
+#ifndef ARCH_HPP
+#define ARCH_HPP
+
+#include "state.hpp"
+
+#include <initializer_list>
+
+namespace mini {
+
+constexpr int ceil_to(int n, int m) { return (n + m - 1) / m * m; }
+
+// the widest register, the rows and the activations of the layers are padded to it
+constexpr int LAYER_ALIGN = 64;
+
+// ClippedReLU takes int32 >> WEIGHT_SHIFT into [0, 127]
+constexpr int WEIGHT_SHIFT = 6;
+
+/*
+ * The layers after the feature transformer, composed at compile time into a LayerStack.
+ * Each one describes its parameters and its part of the hash of the architecture,
+ * the kernels that run them are in layers.hpp. The first layer reads the transformer
+ * output, the last one gives the eval in the units of the linear output (see S_W).
+ * */
+enum class LayerKind {
+    LINEAR_OUTPUT,
+    AFFINE,
+    SPARSE_AFFINE,
+    CLIPPED_RELU,
+};
+
+// The output of the default net, straight from both int16 accumulator halves
+template<int N_INPUT>
+struct LinearOutput {
+    static constexpr LayerKind KIND = LayerKind::LINEAR_OUTPUT;
+    static constexpr int N_IN = 2 * N_INPUT, N_OUT = 1;
+    static constexpr uint32_t HASH = 0x4C1A3D5Bu ^ uint32_t(N_IN);
+
+    struct Params {
+        alignas(ACC_ALIGN) int16_t out_weight[2][N_INPUT];
+        int16_t out_bias;
+    };
+};
+
+/*
+ * int8 weights, int32 biases, uint8 activations in and int32 out.
+ * With enough outputs to fill a register the weights of a group of 4 inputs 
+ * are side by side for all outputs, so the kernel broadcasts the inputs and needs 
+ * no horizontal sums. Otherwise they are row by row, padded to LAYER_ALIGN inputs,
+ * and the padding inputs are zero.
+ * */
+template<int IN, int OUT>
+struct Affine {
+    static constexpr LayerKind KIND = LayerKind::AFFINE;
+    static constexpr int N_IN = IN, N_OUT = OUT;
+    static constexpr uint32_t HASH = 0xCC03DAE4u ^ uint32_t(IN << 16 | OUT);
+
+    static constexpr bool BY_GROUP = OUT * 4 % LAYER_ALIGN == 0 && IN % 4 == 0;
+    static constexpr int N_IN_PADDED = ceil_to(IN, LAYER_ALIGN);
+    static constexpr int N_WEIGHTS = BY_GROUP ? IN * OUT : OUT * N_IN_PADDED;
+
+    // where the weight of input i to output o is
+    static constexpr int weight_index(int o, int i) {
+        return BY_GROUP ? (i / 4 * OUT + o) * 4 + i % 4 : o * N_IN_PADDED + i;
+    }
+
+    using Input = uint8_t;
+    using Output = int32_t;
+
+    struct Params {
+        alignas(LAYER_ALIGN) int32_t bias[OUT];
+        alignas(LAYER_ALIGN) int8_t weight[N_WEIGHTS];
+    };
+};
+
+// The same for inputs that are mostly zero, like the clipped transformer output:
+// only the groups of 4 inputs with a nonzero one are multiplied
+template<int IN, int OUT>
+struct SparseAffine : Affine<IN, OUT> {
+    static_assert(Affine<IN, OUT>::BY_GROUP);
+
+    static constexpr LayerKind KIND = LayerKind::SPARSE_AFFINE;
+    static constexpr uint32_t HASH = 0x7A12C1EFu ^ uint32_t(IN << 16 | OUT);
+};
+
+template<int N>
+struct ClippedReLU {
+    static constexpr LayerKind KIND = LayerKind::CLIPPED_RELU;
+    static constexpr int N_IN = N, N_OUT = N;
+    static constexpr uint32_t HASH = 0x538D24C7u ^ uint32_t(N);
+
+    using Input = int32_t;
+    using Output = uint8_t;
+
+    struct Params {};
+};
+
+/*
+ * The layers come in N_OUTPUT_BUCKETS copies, the one for a position picked 
+ * by the number of pieces on the board. An endgame gets weights of its own 
+ * and the transformer, where the time goes, stays the same.
+ * */
+constexpr int N_OUTPUT_BUCKETS = 8;
+
+constexpr int output_bucket(int n_pieces) {
+    return (n_pieces - 1) * N_OUTPUT_BUCKETS / 32;
+}
+
+static_assert(output_bucket(2) == 0 && output_bucket(32) == N_OUTPUT_BUCKETS - 1);
+
+// The parameters of the layers in order, which is also their order in a raw net file
+template<typename L, typename... Rest>
+struct StackParams {
+    typename L::Params layer;
+    StackParams<Rest...> next;
+};
+
+template<typename L>
+struct StackParams<L> {
+    typename L::Params layer;
+};
+
+template<typename L, typename... Rest>
+struct LayerStack {
+    using Params = StackParams<L, Rest...>;
+
+    // the default net, its output reads the accumulator itself
+    static constexpr bool LINEAR = L::KIND == LayerKind::LINEAR_OUTPUT;
+
+    // folded over the layers, net files carry it and are rejected when it differs
+    static constexpr uint32_t HASH = [] {
+        uint32_t h = 0xEC42E90Du ^ uint32_t(N_FEATURES) ^ uint32_t(N_HIDDEN) << 16
+            ^ uint32_t(N_OUTPUT_BUCKETS) << 26;
+        for (uint32_t x: { L::HASH, Rest::HASH... })
+            h = (h << 1 | h >> 31) ^ x;
+        return h;
+    }();
+
+    template<template<typename...> typename T>
+    using apply = T<L, Rest...>;
+
+    // whether the sizes fit from the transformer to the single output
+    static constexpr bool chained() {
+        constexpr int n_in[] = { L::N_IN, Rest::N_IN... };
+        constexpr int n_out[] = { L::N_OUT, Rest::N_OUT... };
+        for (int i = 1; i <= int(sizeof...(Rest)); ++i)
+            if (n_out[i - 1] != n_in[i])
+                return false;
+        return n_in[0] == 2 * N_HIDDEN && n_out[sizeof...(Rest)] == 1
+            && (!LINEAR || sizeof...(Rest) == 0);
+    }
+};
+
+/*
+ * The compiled architecture. The default net is the transformer straight into
+ * the linear output, NNUE_HIDDEN_LAYERS (see CMakeLists.txt) puts hidden layers in between,
+ * slower but a better eval once trained.
+ * */
+#if defined(NNUE_HIDDEN_LAYERS)
+using Architecture = LayerStack<
+    SparseAffine<2 * N_HIDDEN, 16>, ClippedReLU<16>,
+    Affine<16, 32>, ClippedReLU<32>,
+    Affine<32, 1>>;
+#else
+using Architecture = LayerStack<LinearOutput<N_HIDDEN>>;
+#endif
+
+static_assert(Architecture::chained(), "each layer must take what the one before gives, "
+        "down to a single output, and the linear output comes alone");
+
+
+} // mini
+
+#endif
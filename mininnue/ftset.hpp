@@ -3,15 +3,11 @@
 
 #include "../primitives/common.hpp"
 #include "../board/board.hpp"
+#include "state.hpp"
 
 
 namespace mini {
 
-constexpr int N_KING_BUCKETS = 4;
-
-constexpr int N_FEATURES = 12 * 64 * N_KING_BUCKETS;
-constexpr int MAX_TOTAL_FTS = 32;
-
 constexpr int KING_BUCKETS[] = {
     0, 0, 1, 1, 1, 1, 0, 0,
     2, 2, 2, 2, 2, 2, 2, 2,
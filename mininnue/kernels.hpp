@@ -0,0 +1,105 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+#include "state.hpp"
+#include "arch.hpp"
+
+namespace mini {
+
+using FtSpan = Span<uint16_t>;
+
+constexpr int S_A = 256;
+constexpr int S_W = 4096;
+
+/*
+ * The parameters of the net as they are laid out in memory, 
+ * which is also the body of a raw net file (see save_raw in nnue.hpp)
+ * */
+struct NetParams {
+    alignas(ACC_ALIGN) int16_t ft_weight[N_FEATURES * N_HIDDEN];
+    alignas(ACC_ALIGN) int16_t ft_bias[N_HIDDEN];
+    int16_t ft_psqt[N_FEATURES];
+
+    // the layers after the transformer for each output bucket, see arch.hpp
+    Architecture::Params head[N_OUTPUT_BUCKETS];
+};
+
+// int8 copies of the weights for the int8 kernels, w ~ w8 * scale.
+// The hidden layers are int8 already, only the linear output has a copy.
+struct NetInt8 {
+    alignas(ACC_ALIGN) int8_t ft_weight[N_FEATURES * N_HIDDEN];
+    alignas(ACC_ALIGN) int8_t out_weight[N_OUTPUT_BUCKETS][2][N_HIDDEN];
+    int16_t ft_scale, out_scale;
+};
+
+// Fills the int8 weights from the int16 ones, with one scale for each layer
+void quantise(const NetParams &params, NetInt8 &q);
+
+/*
+ * What the kernels read, shared by all kernel sets: the parameters 
+ * wherever they are, in memory or mapped from a file, and their int8 copies
+ * */
+struct Net {
+    const int16_t *ft_weight, *ft_bias, *ft_psqt;
+    const Architecture::Params *head;
+    // those of the linear output of each bucket, null with hidden layers
+    const int16_t (*out_weight[N_OUTPUT_BUCKETS])[N_HIDDEN];
+    int16_t out_bias[N_OUTPUT_BUCKETS];
+
+    const int8_t *ft_weight8;
+    const int8_t (*out_weight8)[2][N_HIDDEN];
+    int16_t ft_scale, out_scale;
+};
+
+// The feature changes of a single move: quiet moves and promotions, 
+// captures and promotions with capture, castling
+enum DeltaShape {
+    SHAPE_1A1S,
+    SHAPE_1A2S,
+    SHAPE_2A2S,
+
+    N_SHAPES,
+};
+
+constexpr int SHAPE_ADDS[N_SHAPES] = { 1, 1, 2 };
+constexpr int SHAPE_SUBS[N_SHAPES] = { 1, 2, 2 };
+
+/*
+ * One set of kernels per instruction set. Each set lives in its own 
+ * translation unit compiled with its own target flags (see CMakeLists.txt), 
+ * so one binary runs everywhere and still uses the widest registers there are.
+ * */
+struct Kernels {
+    const char *name;
+    // whether they read the int8 weights of the net
+    bool int8;
+
+    void (*refresh_acc)(const Net &net, Accumulator &acc, FtSpan features, Color pov);
+    void (*update_acc)(const Net &net, Accumulator &acc, FtSpan add, FtSpan sub, Color pov);
+    // src + add - sub into dst, indexed by DeltaShape
+    void (*update_fused[N_SHAPES])(const Net &net, const Accumulator &src, Accumulator &dst,
+            const uint16_t *add, const uint16_t *sub, Color pov);
+    // see Transformer::update_chain
+    void (*update_chain)(const Net &net, const Accumulator &src, Accumulator *const *dst,
+            const FtSpan *add, const FtSpan *sub, int n, Color pov);
+
+    // the layers after the transformer without the psqt part, stm's half goes first
+    int32_t (*forward)(const Net &net, const Accumulator &acc, Color stm, int bucket);
+};
+
+namespace ssse3 { extern const Kernels kernels, kernels_int8; }
+namespace avx2 { extern const Kernels kernels, kernels_int8; }
+namespace avx512 { extern const Kernels kernels, kernels_int8; }
+namespace avx512vnni { extern const Kernels kernels, kernels_int8; }
+
+// the parameters and the kernels evaluate uses, for the benchmarks
+const Net& loaded_net();
+const Kernels& active_kernels();
+
+// Fills sets with every kernel set the CPU can run, the best first. Returns their number.
+int supported_kernels(const Kernels **sets, bool int8 = false);
+
+
+} // mini
+
+#endif
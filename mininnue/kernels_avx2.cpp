@@ -0,0 +1,2 @@
+// compiled with the avx2 target flags, see CMakeLists.txt
+#include "kernels_impl.hpp"
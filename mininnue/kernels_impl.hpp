@@ -0,0 +1,92 @@
+/*
+ * The body of a kernel translation unit. It is included by kernels_<isa>.cpp 
+ * only, each compiled with different target flags. Everything here must stay 
+ * in the SIMD_NS namespace: an inline function shared with the rest of the 
+ * program could be emitted with e.g. AVX-512 instructions and picked by the linker 
+ * for all callers, which would then crash on older CPUs.
+ * */
+
+#include "layers.hpp"
+#include "kernels.hpp"
+
+namespace mini {
+namespace SIMD_NS {
+
+namespace {
+
+using Transformer = layers::Transformer<N_FEATURES, N_HIDDEN>;
+using Transformer8 = layers::Transformer<N_FEATURES, N_HIDDEN, int8_t>;
+using Output = layers::Output<N_HIDDEN, S_A>;
+using Output8 = layers::Output8<N_HIDDEN, S_A>;
+
+// over the int16 or the quantised weights of the net
+template<bool INT8>
+auto transformer(const Net &net) {
+    if constexpr (INT8)
+        return Transformer8(net.ft_weight8, net.ft_bias, net.ft_psqt, net.ft_scale);
+    else
+        return Transformer(net.ft_weight, net.ft_bias, net.ft_psqt);
+}
+
+template<bool INT8>
+void refresh_acc(const Net &net, Accumulator &acc, FtSpan features, Color pov) {
+    transformer<INT8>(net).refresh_acc(acc, features, pov);
+}
+
+template<bool INT8>
+void update_acc(const Net &net, Accumulator &acc, FtSpan add, FtSpan sub, Color pov) {
+    transformer<INT8>(net).update_acc(acc, add, sub, pov);
+}
+
+template<bool INT8, int N_ADD, int N_SUB>
+void update_fused(const Net &net, const Accumulator &src, Accumulator &dst,
+        const uint16_t *add, const uint16_t *sub, Color pov)
+{
+    transformer<INT8>(net).template update_fused<N_ADD, N_SUB>(src, dst, add, sub, pov);
+}
+
+template<bool INT8>
+void update_chain(const Net &net, const Accumulator &src, Accumulator *const *dst,
+        const FtSpan *add, const FtSpan *sub, int n, Color pov) 
+{
+    transformer<INT8>(net).update_chain(src, dst, add, sub, n, pov);
+}
+
+template<typename... Layers>
+int32_t forward_hidden(const StackParams<Layers...> &head, const Accumulator &acc, Color stm) {
+    alignas(LAYER_ALIGN) uint8_t x[2 * N_HIDDEN];
+    layers::transform<N_HIDDEN, S_A>(acc, stm, x);
+    return layers::Stack<Layers...>::forward(head, x);
+}
+
+// the hidden layers are int8 whichever weights the transformer has
+template<bool INT8>
+int32_t forward(const Net &net, const Accumulator &acc, Color stm, int bucket) {
+    if constexpr (!Architecture::LINEAR)
+        return forward_hidden(net.head[bucket], acc, stm);
+    else if constexpr (INT8)
+        return net.out_bias[bucket] + 2 * net.out_scale
+            * (Output8(net.out_weight8[bucket][0]).forward(acc.v[stm]) 
+                + Output8(net.out_weight8[bucket][1]).forward(acc.v[~stm]));
+    else
+        return net.out_bias[bucket]
+            + Output(net.out_weight[bucket][0]).forward(acc.v[stm]) 
+            + Output(net.out_weight[bucket][1]).forward(acc.v[~stm]);
+}
+
+} // namespace
+
+extern const Kernels kernels = { 
+    SIMD_ARCH, false, refresh_acc<false>, update_acc<false>, 
+    { update_fused<false, 1, 1>, update_fused<false, 1, 2>, update_fused<false, 2, 2> },
+    update_chain<false>, forward<false> 
+};
+
+extern const Kernels kernels_int8 = { 
+    SIMD_ARCH_INT8, true, refresh_acc<true>, update_acc<true>, 
+    { update_fused<true, 1, 1>, update_fused<true, 1, 2>, update_fused<true, 2, 2> },
+    update_chain<true>, forward<true> 
+};
+
+} // SIMD_NS
+} // mini
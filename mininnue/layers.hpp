@@ -2,29 +2,28 @@
 #define LAYERS_HPP
 
 #include "simd.hpp"
-#include "state.hpp"
-#include <istream>
+#include "kernels.hpp"
 
-namespace mini {
-
-using FtSpan = Span<uint16_t>;
+#include <algorithm>
+#include <cstring>
+#include <initializer_list>
+#include <type_traits>
 
+namespace mini {
+namespace SIMD_NS {
 namespace layers {
 
-template<int N_FEATURES, int N_HIDDEN>
+/*
+ * The layers only point to the parameters, which are stored once for all kernel sets.
+ * With W = int8_t the columns are quantised: they are widened and multiplied 
+ * by the scale of the net when loaded, the accumulator stays int16 either way.
+ * */
+template<int N_FEATURES, int N_HIDDEN, typename W = int16_t>
 struct Transformer {
-    bool load_parameters(std::istream &is) {
-        if (!is.read((char*)psqt_, sizeof(psqt_)))
-            return false;
+    static_assert(std::is_same_v<W, int16_t> || std::is_same_v<W, int8_t>);
 
-        if (!is.read((char*)bias_, sizeof(bias_)))
-            return false;
-
-        if (!is.read((char*)weight_, sizeof(weight_)))
-            return false;
-
-        return true;
-    }
+    Transformer(const W *weight, const int16_t *bias, const int16_t *psqt, int16_t scale = 1)
+        : weight_(weight), bias_(bias), psqt_(psqt), scale_(vec_set1_epi16(scale)) {}
 
     void refresh_acc(Accumulator &acc, FtSpan features, Color pov) const {
         apply_features<true>(acc, features, FtSpan(), pov);
@@ -34,11 +33,101 @@ struct Transformer {
         apply_features<false>(acc, add, sub, pov);
     }
 
+    // src + add - sub into dst for the few fixed shapes of a single move,
+    // every register is loaded once, gets all columns and is stored once
+    template<int N_ADD, int N_SUB>
+    void update_fused(const Accumulator &src, Accumulator &dst, 
+            const uint16_t *add, const uint16_t *sub, Color pov) const 
+    {
+        constexpr int n_vecs = N_HIDDEN * 16 / simd_reg_width;
+
+        auto src_vec = (const SIMDVector*)src.v[pov];
+        auto dst_vec = (SIMDVector*)dst.v[pov];
+
+        const W *add_cols[N_ADD], *sub_cols[N_SUB];
+        for (int j = 0; j < N_ADD; ++j)
+            add_cols[j] = &weight_[N_HIDDEN * add[j]];
+        for (int j = 0; j < N_SUB; ++j)
+            sub_cols[j] = &weight_[N_HIDDEN * sub[j]];
+
+        for (int i = 0; i < n_vecs; ++i) {
+            SIMDVector x = src_vec[i];
+            for (int j = 0; j < N_ADD; ++j)
+                x = vec_add_epi16(x, column(add_cols[j], i));
+            for (int j = 0; j < N_SUB; ++j)
+                x = vec_sub_epi16(x, column(sub_cols[j], i));
+            dst_vec[i] = x;
+        }
+
+        int32_t psqt = src.psqt[pov];
+        for (int j = 0; j < N_ADD; ++j) psqt += psqt_[add[j]];
+        for (int j = 0; j < N_SUB; ++j) psqt -= psqt_[sub[j]];
+        dst.psqt[pov] = psqt;
+    }
+
+    /*
+     * Catches up n plies at once. Every register slice is loaded from src once,
+     * then for each ply gets that ply's features added and subtracted 
+     * and is stored into the ply's accumulator, never reloaded in between.
+     * */
+    void update_chain(const Accumulator &src, Accumulator *const *dst, 
+            const FtSpan *add, const FtSpan *sub, int n, Color pov) const 
+    {
+        constexpr int reg_width = simd_reg_width / 16;
+        constexpr int n_regs = N_HIDDEN / reg_width < SIMD_REGISTERS 
+            ? N_HIDDEN / reg_width : SIMD_REGISTERS;
+        constexpr int pass_size = n_regs * reg_width;
+        constexpr int n_passes = N_HIDDEN / pass_size;
+
+        for (int pass = 0; pass < n_passes; ++pass) {
+            const int off = pass * pass_size;
+            auto src_vec_slice = (const SIMDVector*)&src.v[pov][off];
+
+            SIMDVector regs[n_regs];
+            for (int i = 0; i < n_regs; ++i)
+                regs[i] = src_vec_slice[i];
+
+            for (int ply = 0; ply < n; ++ply) {
+                for (uint16_t idx: add[ply]) {
+                    const W *column_slice = &weight_[N_HIDDEN * idx + off];
+                    for (int i = 0; i < n_regs; ++i)
+                        regs[i] = vec_add_epi16(regs[i], column(column_slice, i));
+                }
+
+                for (uint16_t idx: sub[ply]) {
+                    const W *column_slice = &weight_[N_HIDDEN * idx + off];
+                    for (int i = 0; i < n_regs; ++i)
+                        regs[i] = vec_sub_epi16(regs[i], column(column_slice, i));
+                }
+
+                auto dst_vec_slice = (SIMDVector*)&dst[ply]->v[pov][off];
+                for (int i = 0; i < n_regs; ++i)
+                    dst_vec_slice[i] = regs[i];
+            }
+        }
+
+        int32_t psqt = src.psqt[pov];
+        for (int ply = 0; ply < n; ++ply) {
+            for (uint16_t idx: add[ply]) psqt += psqt_[idx];
+            for (uint16_t idx: sub[ply]) psqt -= psqt_[idx];
+            dst[ply]->psqt[pov] = psqt;
+        }
+    }
+
 private:
+    // the i-th register of a column (slice)
+    SIMDVector column(const W *col, int i) const {
+        if constexpr (std::is_same_v<W, int8_t>)
+            return vec_mullo_epi16(vec_load_epi8_epi16(col + i * simd_reg_width / 16), scale_);
+        else
+            return ((const SIMDVector*)col)[i];
+    }
+
     template<bool refresh>
     void apply_features(Accumulator &acc, FtSpan ft_add, FtSpan ft_sub, Color pov) const {
         constexpr int reg_width = simd_reg_width / 16;
-        constexpr int n_regs = std::min(N_HIDDEN / reg_width, SIMD_REGISTERS);
+        constexpr int n_regs = N_HIDDEN / reg_width < SIMD_REGISTERS 
+            ? N_HIDDEN / reg_width : SIMD_REGISTERS;
 
         static_assert(N_HIDDEN % reg_width == 0);
 
@@ -61,15 +150,15 @@ private:
             }
 
             for (uint16_t idx: ft_add) {
-                auto column_vec = (const SIMDVector*)&weight_[N_HIDDEN * idx + off];
+                const W *column_slice = &weight_[N_HIDDEN * idx + off];
                 for (int i = 0; i < n_regs; ++i)
-                    regs[i] = vec_add_epi16(regs[i], column_vec[i]);
+                    regs[i] = vec_add_epi16(regs[i], column(column_slice, i));
             }
 
             for (uint16_t idx: ft_sub) {
-                auto column_vec = (const SIMDVector*)&weight_[N_HIDDEN * idx + off];
+                const W *column_slice = &weight_[N_HIDDEN * idx + off];
                 for (int i = 0; i < n_regs; ++i)
-                    regs[i] = vec_sub_epi16(regs[i], column_vec[i]);
+                    regs[i] = vec_sub_epi16(regs[i], column(column_slice, i));
             }
 
             for (int i = 0; i < n_regs; ++i)
@@ -83,18 +172,15 @@ private:
         for (uint16_t idx: ft_sub) acc.psqt[pov] -= psqt_[idx];
     }
 
-    alignas(SIMD_ALIGN) int16_t weight_[N_FEATURES * N_HIDDEN];
-    alignas(SIMD_ALIGN) int16_t bias_[N_HIDDEN];
-    int16_t psqt_[N_FEATURES];
+    const W *weight_;
+    const int16_t *bias_, *psqt_;
+    SIMDVector scale_;
 };
 
 template<int N_INPUT, int16_t S_A>
 struct Output {
-    bool load_parameters(std::istream &is) {
-        if (!is.read((char*)weight_, sizeof(weight_)))
-            return false;
-        return true;
-    }
+    explicit Output(const int16_t *weight)
+        : weight_(weight) {}
 
     int32_t forward(const int16_t* x) const {
         const SIMDVector min{};
@@ -116,24 +202,246 @@ struct Output {
 
             for (int j = 0; j < unroll_factor; ++j) {
                 auto u = vec_min_epi16(max, vec_max_epi16(min, in_vec[i + j]));
-                sums[j] = vec_add_epi32(sums[j], vec_madd_epi16(u, weight_vec[i + j]));
+                sums[j] = vec_dpwssd_epi32(sums[j], u, weight_vec[i + j]);
             }
 
         }
 
+        // no horizontal add on AVX-512, a vertical tree does the same in integers
         for (int i = unroll_factor / 2; i > 0; i /= 2)
             for (int j = 0; j < i; ++j)
-                sums[j] = vec_hadd_epi32(sums[2 * j], sums[2 * j + 1]);
+                sums[j] = vec_add_epi32(sums[j], sums[j + i]);
 
         return vec_hsum_epi32(sums[0]);
     }
 
 private:
-    alignas(SIMD_ALIGN) int16_t weight_[N_INPUT];
+    const int16_t *weight_;
+};
+
+/*
+ * The output layer over int8 weights. The activations are clipped to [0, S_A] 
+ * and halved to fit a byte, so the caller scales the result by 2 * the weight scale.
+ * With at most 128 per activation and 127 per weight maddubs never saturates.
+ * */
+template<int N_INPUT, int16_t S_A>
+struct Output8 {
+    explicit Output8(const int8_t *weight)
+        : weight_(weight) {}
+
+    int32_t forward(const int16_t* x) const {
+        const SIMDVector min{};
+        const SIMDVector max = vec_set1_epi16(S_A);
+
+        auto in_vec = (const SIMDVector*)x;
+        auto weight_vec = (const SIMDVector*)weight_;
+
+        // every chunk takes two input registers
+        constexpr int unroll_factor = SIMD_REGISTERS / 4;
+        constexpr int chunk_size = simd_reg_width / 8;
+        constexpr int n_chunks = N_INPUT / chunk_size;
+
+        SIMDVector sums[unroll_factor]{};
+
+        static_assert(n_chunks % unroll_factor == 0);
+
+        for (int i = 0; i < n_chunks; i += unroll_factor) {
+
+            for (int j = 0; j < unroll_factor; ++j) {
+                auto lo = vec_min_epi16(max, vec_max_epi16(min, in_vec[2 * (i + j)]));
+                auto hi = vec_min_epi16(max, vec_max_epi16(min, in_vec[2 * (i + j) + 1]));
+                auto u = vec_packus_epi16(vec_srli_epi16(lo, 1), vec_srli_epi16(hi, 1));
+                sums[j] = vec_dpbusd_epi32(sums[j], u, weight_vec[i + j]);
+            }
+
+        }
+
+        for (int i = unroll_factor / 2; i > 0; i /= 2)
+            for (int j = 0; j < i; ++j)
+                sums[j] = vec_add_epi32(sums[j], sums[j + i]);
+
+        return vec_hsum_epi32(sums[0]);
+    }
+
+private:
+    const int8_t *weight_;
+};
+
+
+/*
+ * What the hidden layers read: both accumulator halves clipped to [0, S_A] 
+ * and halved into bytes, stm's half first, as the int8 output layer does
+ * */
+template<int N_HIDDEN, int16_t S_A>
+void transform(const Accumulator &acc, Color stm, uint8_t *out) {
+    const SIMDVector min{};
+    const SIMDVector max = vec_set1_epi16(S_A);
+
+    constexpr int chunk_size = simd_reg_width / 8;
+    static_assert(N_HIDDEN % chunk_size == 0);
+
+    auto out_vec = (SIMDVector*)out;
+    for (Color c: { stm, ~stm }) {
+        auto in_vec = (const SIMDVector*)acc.v[c];
+        for (int i = 0; i < N_HIDDEN / chunk_size; ++i) {
+            auto lo = vec_min_epi16(max, vec_max_epi16(min, in_vec[2 * i]));
+            auto hi = vec_min_epi16(max, vec_max_epi16(min, in_vec[2 * i + 1]));
+            *out_vec++ = vec_packus_epi16(vec_srli_epi16(lo, 1), vec_srli_epi16(hi, 1));
+        }
+    }
+}
+
+// The kernel of each hidden layer shape, see arch.hpp
+template<typename L>
+struct Layer;
+
+// for every 8-bit mask the positions of its set bits, and their number
+struct NnzIndices {
+    alignas(16) uint16_t idx[256][8];
+    uint8_t count[256];
+};
+
+constexpr NnzIndices NNZ_INDICES = [] {
+    NnzIndices t{};
+    for (int m = 0; m < 256; ++m)
+        for (int b = 0; b < 8; ++b)
+            if (m >> b & 1)
+                t.idx[m][t.count[m]++] = uint16_t(b);
+    return t;
+}();
+
+/*
+ * Every group of 4 inputs is broadcast and multiplied with its weights for all outputs 
+ * at once, see Affine. The groups go round a few independent sums, one chain of dpbusd 
+ * would wait for the latency of each before the next. With SPARSE the nonzero groups 
+ * are listed first, without a branch per group, and only they are multiplied.
+ * */
+template<int IN, int OUT, bool SPARSE>
+void affine_by_group(const int32_t *bias, const int8_t *weight, const uint8_t *in, int32_t *out) {
+    constexpr int n_groups = IN / 4;
+    constexpr int n_regs = OUT * 32 / simd_reg_width;
+    constexpr int n_chains = n_regs >= 4 ? 1 : 4 / n_regs;
+
+    alignas(16) uint16_t nnz[n_groups + 8];
+    int n_nnz = n_groups;
+
+    if constexpr (SPARSE) {
+        // 8 groups at a time: their nonzero mask picks the indices to append
+        constexpr int lanes = simd_reg_width / 32;
+        constexpr int regs_per_8 = lanes >= 8 ? 1 : 8 / lanes;
+
+        auto in_vec = (const SIMDVector*)in;
+        __m128i base = _mm_setzero_si128();
+        n_nnz = 0;
+        for (int r = 0; r < n_groups / lanes; r += regs_per_8) {
+            unsigned mask = 0;
+            for (int i = 0; i < regs_per_8; ++i)
+                mask |= vec_nz_mask_epi32(in_vec[r + i]) << (i * lanes);
+
+            for (int b = 0; b < lanes * regs_per_8; b += 8) {
+                const unsigned m = mask >> b & 0xFF;
+                const __m128i idx = _mm_load_si128((const __m128i*)NNZ_INDICES.idx[m]);
+                _mm_storeu_si128((__m128i*)&nnz[n_nnz], _mm_add_epi16(base, idx));
+                n_nnz += NNZ_INDICES.count[m];
+                base = _mm_add_epi16(base, _mm_set1_epi16(8));
+            }
+        }
+    }
+
+    auto bias_vec = (const SIMDVector*)bias;
+    SIMDVector sums[n_chains][n_regs]{};
+    for (int i = 0; i < n_regs; ++i)
+        sums[0][i] = bias_vec[i];
+
+    auto add_group = [&](SIMDVector *sum, int j) {
+        int32_t x;
+        memcpy(&x, in + 4 * j, 4);
+
+        const SIMDVector x_vec = vec_set1_epi32(x);
+        auto weight_vec = (const SIMDVector*)&weight[j * OUT * 4];
+        for (int i = 0; i < n_regs; ++i)
+            sum[i] = vec_dpbusd_epi32(sum[i], x_vec, weight_vec[i]);
+    };
+    auto group = [&](int k) { return SPARSE ? int(nnz[k]) : k; };
+
+    int k = 0;
+    for (; k + n_chains <= n_nnz; k += n_chains)
+        for (int c = 0; c < n_chains; ++c)
+            add_group(sums[c], group(k + c));
+    for (; k < n_nnz; ++k)
+        add_group(sums[0], group(k));
+
+    for (int c = 1; c < n_chains; ++c)
+        for (int i = 0; i < n_regs; ++i)
+            sums[0][i] = vec_add_epi32(sums[0][i], sums[c][i]);
+
+    // Not out_vec[i] = sums[0][i]: gcc 12 forwards the array element into such a store,
+    // retypes it as a vector of long long without the may_alias of SIMDVector and then
+    // removes it as dead ahead of the int32 reads of the next layer. It reproduces with
+    // any element of a local __m512i array stored through __m512i* into an int32_t buffer.
+    for (int i = 0; i < n_regs; ++i)
+        memcpy(out + i * simd_reg_width / 32, &sums[0][i], sizeof(SIMDVector));
+}
+
+template<int IN, int OUT>
+struct Layer<Affine<IN, OUT>> {
+    using Shape = Affine<IN, OUT>;
+
+    static void forward(const typename Shape::Params &p, const uint8_t *in, int32_t *out) {
+        if constexpr (Shape::BY_GROUP) {
+            affine_by_group<IN, OUT, false>(p.bias, p.weight, in, out);
+        } else {
+            constexpr int n_chunks = Shape::N_IN_PADDED * 8 / simd_reg_width;
+
+            auto in_vec = (const SIMDVector*)in;
+            for (int o = 0; o < OUT; ++o) {
+                auto weight_vec = (const SIMDVector*)&p.weight[o * Shape::N_IN_PADDED];
+                SIMDVector sum{};
+                for (int i = 0; i < n_chunks; ++i)
+                    sum = vec_dpbusd_epi32(sum, in_vec[i], weight_vec[i]);
+                out[o] = p.bias[o] + vec_hsum_epi32(sum);
+            }
+        }
+    }
+};
+
+template<int IN, int OUT>
+struct Layer<SparseAffine<IN, OUT>> {
+    static void forward(const typename SparseAffine<IN, OUT>::Params &p, 
+            const uint8_t *in, int32_t *out) 
+    {
+        affine_by_group<IN, OUT, true>(p.bias, p.weight, in, out);
+    }
+};
+
+template<int N>
+struct Layer<ClippedReLU<N>> {
+    static void forward(const typename ClippedReLU<N>::Params&, const int32_t *in, uint8_t *out) {
+        for (int i = 0; i < N; ++i)
+            out[i] = uint8_t(std::clamp(in[i] >> WEIGHT_SHIFT, 0, 127));
+    }
+};
+
+/*
+ * The hidden layers one after another. Every activation is a buffer on the stack 
+ * padded with zeros to LAYER_ALIGN, which Affine reads past its inputs.
+ * */
+template<typename L, typename... Rest>
+struct Stack {
+    static int32_t forward(const StackParams<L, Rest...> &p, const typename L::Input *in) {
+        alignas(LAYER_ALIGN) typename L::Output out[ceil_to(L::N_OUT, LAYER_ALIGN)]{};
+        Layer<L>::forward(p.layer, in, out);
+
+        if constexpr (sizeof...(Rest) == 0)
+            return out[0];
+        else
+            return Stack<Rest...>::forward(p.next, out);
+    }
 };
 
 
 } // layers
+} // SIMD_NS
 
 
 } // mini
@@ -1,7 +1,8 @@
 #include "nnue.hpp"
 #include "ftset.hpp"
-#include "layers.hpp"
+#include "kernels.hpp"
 #include "../primitives/utility.hpp"
+#include "../primitives/cpu.hpp"
 
 #include "../board/board.hpp"
 #include "../scout.hpp"
@@ -9,6 +10,20 @@
 #include <fstream>
 #include <streambuf>
 #include <vector>
+#include <random>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <string>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "../incbin.h"
 #include "../pack.hpp"
@@ -20,14 +35,193 @@ namespace mini {
 INCBIN(uint8_t, _net, EVALFILE);
 
 
-constexpr int S_A = 256;
-constexpr int S_W = 4096;
-
 bool NNUE_LOADED = false;
+// bumped on every load, so that the accumulator caches know they are stale
+uint32_t NET_VERSION = 0;
+
+/*
+ * A raw net file is this header, padded to RAW_NET_OFFSET, followed by NetParams 
+ * exactly as they are in memory (native byte order), so it can be mapped and used in place.
+ * It's the only format that says which layers follow the transformer (see arch.hpp),
+ * the others are always the transformer and the linear output.
+ * */
+struct RawNetHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_features, n_hidden;
+    uint32_t params_size;
+    uint32_t arch_hash;
+};
+
+constexpr char RAW_NET_MAGIC[8] = "saturnN";
+constexpr uint32_t RAW_NET_VERSION = 2;
+// keeps the parameters aligned both in the file and in the mapping
+constexpr size_t RAW_NET_OFFSET = 64;
+
+static_assert(sizeof(RawNetHeader) <= RAW_NET_OFFSET && RAW_NET_OFFSET % ACC_ALIGN == 0);
+
+// the parameters unless they are mapped from a raw net file
+alignas(4096) NetParams params;
+NetInt8 params8;
+const NetParams *active_params = &params;
+
+struct Mapping {
+    void *addr = nullptr;
+    size_t size = 0;
+} mapping;
+
+// the parameters of the linear output of the default net, null with hidden layers
+template<typename Head>
+auto linear_output(Head &head) {
+    using Params = typename LinearOutput<N_HIDDEN>::Params;
+    if constexpr (Architecture::LINEAR)
+        return &head.layer;
+    else
+        return (std::conditional_t<std::is_const_v<Head>, const Params, Params>*)nullptr;
+}
+
+Net net = { 
+    params.ft_weight, params.ft_bias, params.ft_psqt, params.head, {}, {},
+    params8.ft_weight, params8.out_weight, 1, 1,
+};
+
+int supported_kernels(const Kernels **sets, bool int8) {
+    const CPUFeatures &cpu = cpu_features();
+    const bool avx512 = cpu.avx512f && cpu.avx512bw && cpu.avx512vl;
+
+    int n = 0;
+    if (avx512 && cpu.avx512vnni) 
+        sets[n++] = int8 ? &avx512vnni::kernels_int8 : &avx512vnni::kernels;
+    if (avx512) sets[n++] = int8 ? &avx512::kernels_int8 : &avx512::kernels;
+    if (cpu.avx2) sets[n++] = int8 ? &avx2::kernels_int8 : &avx2::kernels;
+    if (cpu.ssse3) sets[n++] = int8 ? &ssse3::kernels_int8 : &ssse3::kernels;
+
+    return n;
+}
+
+const Kernels* best_kernels(bool int8) {
+    const Kernels *sets[4];
+    if (supported_kernels(sets, int8))
+        return sets[0];
+    return int8 ? &ssse3::kernels_int8 : &ssse3::kernels;
+}
+
+const Kernels *kernels = best_kernels(false);
+
+const char* kernels_name() {
+    return kernels->name;
+}
+
+const Net& loaded_net() {
+    return net;
+}
+
+const Kernels& active_kernels() {
+    return *kernels;
+}
+
+namespace {
+
+int8_t quantise(int16_t w, int scale) {
+    // round half away from zero, -128 is left out to keep maddubs from saturating
+    int x = std::min((std::abs(int(w)) + scale / 2) / scale, 127);
+    return int8_t(w < 0 ? -x : x);
+}
+
+/*
+ * The scale with the least total absolute error, from 1 up to the one 
+ * that fits every weight. Clipping the few largest weights 
+ * beats losing the low bits of all the others.
+ * */
+int16_t quantise(const int16_t *w, int8_t *w8, int n) {
+    int max_abs = 1;
+    for (int i = 0; i < n; ++i)
+        max_abs = std::max(max_abs, std::abs(int(w[i])));
+
+    int best_scale = 1;
+    double best_error = 1e300;
+    for (int scale = 1; scale <= (max_abs + 126) / 127; ++scale) {
+        double error = 0;
+        for (int i = 0; i < n; ++i) {
+            error += std::abs(w[i] - quantise(w[i], scale) * scale);
+        }
+
+        if (error < best_error)
+            best_error = error, best_scale = scale;
+    }
+
+    for (int i = 0; i < n; ++i)
+        w8[i] = quantise(w[i], best_scale);
+
+    return int16_t(best_scale);
+}
+
+} // namespace
 
-layers::Transformer<N_FEATURES, N_HIDDEN> ft;
-layers::Output<N_HIDDEN, S_A> fc_out[2];
-int16_t fc_out_bias;
+void quantise(const NetParams &p, NetInt8 &q) {
+    q.ft_scale = quantise(p.ft_weight, q.ft_weight, N_FEATURES * N_HIDDEN);
+    if (!Architecture::LINEAR)
+        return;
+
+    // one scale for all the buckets
+    std::vector<int16_t> w;
+    for (const auto &head: p.head) {
+        const int16_t *out = linear_output(head)->out_weight[0];
+        w.insert(w.end(), out, out + 2 * N_HIDDEN);
+    }
+    q.out_scale = quantise(w.data(), q.out_weight[0][0], int(w.size()));
+}
+
+namespace {
+
+void quantise_net() {
+    quantise(*active_params, params8);
+    net.ft_scale = params8.ft_scale;
+    net.out_scale = params8.out_scale;
+}
+
+// points the layers at p, after quantising it if the int8 kernels are in use
+void use_params(const NetParams *p) {
+    active_params = p;
+
+    net.ft_weight = p->ft_weight;
+    net.ft_bias = p->ft_bias;
+    net.ft_psqt = p->ft_psqt;
+    net.head = p->head;
+    for (int i = 0; i < N_OUTPUT_BUCKETS; ++i) {
+        if (auto *out = linear_output(p->head[i])) {
+            net.out_weight[i] = out->out_weight;
+            net.out_bias[i] = out->out_bias;
+        }
+    }
+
+    if (kernels->int8)
+        quantise_net();
+
+    NNUE_LOADED = true;
+    NET_VERSION++;
+}
+
+// drops the previous mapping once the net is elsewhere
+void unmap_previous() {
+#if defined(__linux__)
+    if (mapping.addr && (const char*)active_params != (char*)mapping.addr + RAW_NET_OFFSET) {
+        munmap(mapping.addr, mapping.size);
+        mapping = Mapping();
+    }
+#endif
+}
+
+} // namespace
+
+void use_int8(bool int8) {
+    kernels = best_kernels(int8);
+
+    if (NNUE_LOADED)
+        use_params(active_params);
+    else
+        NET_VERSION++;
+}
 
 
 namespace detail {
@@ -55,55 +249,239 @@ struct membuf : std::streambuf {
     }
 };
 
+// the lowest bit of a decoded varint is the sign
+inline int16_t from_varint(uint16_t x) {
+    int16_t sign = (x & 1) == 0 ? 1 : -1;
+    return int16_t(x >> 1) * sign;
+}
+
+// A parameter is blocks of block_size bits, lowest first, each followed by a continue bit
 template<int block_size>
-void decompress(BitReader &br, int16_t *params, int n_params) {
-    for (int i = 0; i < n_params; ++i) {
-        int off = 0;
-        uint16_t x = 0;
-        do {
-            x |= br.read<uint16_t>(block_size) << off;
-            off += block_size;
+int16_t decompress_one(BitReader &br) {
+    int off = 0;
+    uint16_t x = 0;
+    do {
+        x |= br.read<uint16_t>(block_size) << off;
+        off += block_size;
 
-        } while (br.read<uint8_t>(1));
+    } while (br.read<uint8_t>(1));
 
-        int16_t sign = (x & 1) == 0 ? 1 : -1;
+    return from_varint(x);
+}
+
+// bit by bit, the reference for decompress
+template<int block_size>
+void decompress_bitwise(BitReader &br, int16_t *params, int n_params) {
+    for (int i = 0; i < n_params; ++i)
+        params[i] = decompress_one<block_size>(br);
+}
 
-        params[i] = int16_t(x >> 1) * sign;
+/*
+ * A 64-bit word at a time: the clear continue bits in the word are where parameters end,
+ * the next 4 are decoded from the one word. Their data bits are gathered with shifts 
+ * and masks, without branches: the number of parameters in a word is random, 
+ * so looping over all of them costs a misprediction per word, more than decoding them.
+ * Words with fewer than 4 ends and the last bytes go through BitReader.
+ * */
+template<int block_size>
+void decompress(const uint8_t *data, size_t size, int16_t *params, int n_params) {
+    constexpr int token_size = block_size + 1;
+    // blocks past the 16 bits of a parameter are dropped
+    constexpr int max_blocks = (16 + block_size - 1) / block_size;
+    constexpr uint32_t block_mask = (1u << block_size) - 1;
+
+    // the continue bits of the tokens within the 57 bits a word has at any bit offset
+    constexpr uint64_t cont_mask = [] {
+        uint64_t m = 0;
+        for (int i = block_size; i < 57; i += token_size)
+            m |= 1ull << i;
+        return m;
+    }();
+
+    BitReader br { data, 0 };
+    int i = 0;
+    while (i < n_params) {
+        if (i + 4 > n_params || br.cursor / 8 + 8 > size) {
+            params[i++] = decompress_one<block_size>(br);
+            continue;
+        }
+
+        uint64_t w;
+        memcpy(&w, data + br.cursor / 8, 8);
+        w >>= br.cursor % 8;
+
+        uint64_t stop = ~w & cont_mask;
+        if (popcnt(stop) < 4) {
+            params[i++] = decompress_one<block_size>(br);
+            continue;
+        }
+
+        int start = 0;
+        for (int k = 0; k < 4; ++k, stop &= stop - 1) {
+            const int end = int(lsb(stop)) + 1;
+            const int n_bits = (end - start) / token_size * block_size;
+            const uint64_t t = w >> start;
+
+            uint32_t x = 0;
+            for (int j = 0; j < max_blocks; ++j)
+                x |= uint32_t(t >> (j * token_size) & block_mask) << (j * block_size);
+            x &= (1u << std::min(n_bits, 16)) - 1;
+
+            params[i++] = from_varint(uint16_t(x));
+            start = end;
+        }
+
+        br.cursor += start;
     }
 }
 
 
-bool load_parameters(std::istream &is) {
-    NNUE_LOADED = false;
+// the number of int16 parameters of the formats without a header with n output buckets
+constexpr uint32_t n_plain_params(int n_buckets) {
+    return N_FEATURES + N_HIDDEN + N_FEATURES * N_HIDDEN + n_buckets * (1 + 2 * N_HIDDEN);
+}
 
-    if (!ft.load_parameters(is))
+bool read_transformer(std::istream &is, NetParams &p) {
+    return is.read((char*)p.ft_psqt, sizeof(p.ft_psqt))
+        && is.read((char*)p.ft_bias, sizeof(p.ft_bias))
+        && is.read((char*)p.ft_weight, sizeof(p.ft_weight));
+}
+
+bool read_output(std::istream &is, LinearOutput<N_HIDDEN>::Params &out) {
+    return is.read((char*)&out.out_bias, sizeof(out.out_bias))
+        && is.read((char*)out.out_weight, sizeof(out.out_weight));
+}
+
+/*
+ * The plain int16 parameters, which only a net without hidden layers can be:
+ * the transformer, then the output of either every bucket or a single one
+ * that all the buckets share. They are read aside, so a file that falls short
+ * leaves the active net as it was.
+ * */
+bool load_parameters(std::istream &is) {
+    if (!Architecture::LINEAR) {
+        sync_cout() << "info string Nets with hidden layers are only loaded from raw files\n";
         return false;
+    }
 
-    if (!is.read((char*)&fc_out_bias, sizeof(fc_out_bias)))
+    std::unique_ptr<NetParams> p(new NetParams);
+    if (!read_transformer(is, *p) || !read_output(is, *linear_output(p->head[0])))
         return false;
 
-    if (!fc_out[0].load_parameters(is))
+    if (is.peek() == std::char_traits<char>::eof()) {
+        for (int i = 1; i < N_OUTPUT_BUCKETS; ++i)
+            p->head[i] = p->head[0];
+    } else {
+        for (int i = 1; i < N_OUTPUT_BUCKETS; ++i)
+            if (!read_output(is, *linear_output(p->head[i])))
+                return false;
+    }
+
+    params = *p;
+    use_params(&params);
+    unmap_previous();
+
+    return true;
+}
+
+// the builtin format: the number of parameters and their bit-packed varints
+bool unpack(const uint8_t *data, size_t size, std::vector<int16_t> &unpacked, bool reference) {
+    if (size < 4)
         return false;
-    if (!fc_out[1].load_parameters(is))
+
+    const uint32_t num_params = *(const uint32_t*)data;
+    if ((num_params != n_plain_params(1) && num_params != n_plain_params(N_OUTPUT_BUCKETS)) 
+            || num_params > (size - 4) * 8 / 5)
         return false;
 
-    NNUE_LOADED = true;
+    unpacked.resize(num_params);
+    if (reference) {
+        BitReader br { data + 4, 0 };
+        decompress_bitwise<4>(br, unpacked.data(), num_params);
+    } else {
+        decompress<4>(data + 4, size - 4, unpacked.data(), num_params);
+    }
 
     return true;
 }
 
-struct AutoInit {
-    AutoInit() {
-        const uint32_t num_params = *(const uint32_t*)&g_netData;
+bool load_compressed(const uint8_t *data, size_t size, bool reference = false) {
+    std::vector<int16_t> unpacked;
+    if (!unpack(data, size, unpacked, reference))
+        return false;
+
+    membuf buf((char*)unpacked.data(), (char*)(unpacked.data() + unpacked.size()));
+    std::istream is(&buf);
+
+    return load_parameters(is);
+}
+
+bool check_header(const RawNetHeader &h) {
+    return !memcmp(h.magic, RAW_NET_MAGIC, sizeof(h.magic))
+        && h.version == RAW_NET_VERSION
+        && h.n_features == N_FEATURES && h.n_hidden == N_HIDDEN
+        && h.params_size == sizeof(NetParams)
+        && h.arch_hash == Architecture::HASH;
+}
+
+/*
+ * Maps the file read-only and shared, so every process using it shares one copy 
+ * of the weights in the page cache, and releases the memory of the parameters 
+ * loaded before. Elsewhere it's read into memory. Either way the active net 
+ * is replaced only once the file checks out.
+ * */
+bool load_raw(const char *path) {
+#if defined(__linux__)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    const size_t size = RAW_NET_OFFSET + sizeof(NetParams);
+    if (fstat(fd, &st) || size_t(st.st_size) != size) {
+        sync_cout() << "info string " << path << " is not a net of this architecture\n";
+        close(fd);
+        return false;
+    }
 
-        BitReader br { g_netData + 4, 0 };
-        std::vector<int16_t> unpacked(num_params);
-        decompress<4>(br, unpacked.data(), num_params);
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return false;
+
+    if (!check_header(*(const RawNetHeader*)addr)) {
+        sync_cout() << "info string " << path << " is not a net of this architecture\n";
+        munmap(addr, size);
+        return false;
+    }
+
+    use_params((const NetParams*)((const char*)addr + RAW_NET_OFFSET));
+    unmap_previous();
+    mapping = Mapping { addr, size };
+
+    // the pages of the in-memory parameters fault back in zeroed if ever touched again
+    madvise(&params, sizeof(params) & ~size_t(4095), MADV_DONTNEED);
+#else
+    std::ifstream fin(path, std::ios::binary);
+    RawNetHeader h;
+    if (!fin.read((char*)&h, sizeof(h)) || !check_header(h))
+        return false;
+
+    std::unique_ptr<NetParams> p(new NetParams);
+    fin.seekg(RAW_NET_OFFSET);
+    if (!fin.read((char*)p.get(), sizeof(NetParams)))
+        return false;
 
-        membuf buf((char*)unpacked.data(), (char*)unpacked.data() + num_params * 2);
-        std::istream is(&buf);
+    params = *p;
+    use_params(&params);
+#endif
 
-        if (!load_parameters(is))
+    return true;
+}
+
+struct AutoInit {
+    AutoInit() {
+        if (!load_builtin())
             sync_cout() << "info string Default NNUE not loaded\n";
     };
 } _;
@@ -114,89 +492,500 @@ struct AutoInit {
 
 
 
-bool update_accumulator(StateInfo *si, Color pov, Square ksq) {
+namespace {
+
+// a single ply of one of the fixed shapes goes through an unrolled kernel
+bool update_single(StateInfo &si, const Accumulator &src, Color pov, Square ksq) {
+    uint16_t added[3], removed[3];
+    int n_added = 0, n_removed = 0;
+
+    for (int i = 0; i < si.nb_deltas; ++i) {
+        const Delta &d = si.deltas[i];
+        if (d.to != SQ_NONE)
+            added[n_added++] = index(pov, d.to, d.piece, ksq);
+        if (d.from != SQ_NONE)
+            removed[n_removed++] = index(pov, d.from, d.piece, ksq);
+    }
+
+    for (int shape = 0; shape < N_SHAPES; ++shape) {
+        if (SHAPE_ADDS[shape] == n_added && SHAPE_SUBS[shape] == n_removed) {
+            kernels->update_fused[shape](net, src, si.acc, added, removed, pov);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+} // namespace
+
+bool update_accumulator(StateInfo *si, Color pov, Square ksq, int refresh_cost) {
     if (si->acc.computed[pov])
         return true;
 
-    if (!si->previous || si == si->previous)
-        return false;
+    // the unevaluated plies, newest first, up to the nearest computed one
+    StateInfo *chain[MAX_UPDATE_CHAIN];
+    int n = 0, n_features = 0;
 
-    const Delta d = si->deltas[0];
-    if (si->nb_deltas && type_of(d.piece) == KING 
-            && !same_king_bucket(pov, d.from, d.to))
-        return false;
+    StateInfo *src = si;
+    for (; !src->acc.computed[pov]; src = src->previous) {
+        if (!src->previous || src == src->previous || n == MAX_UPDATE_CHAIN)
+            return false;
 
-    if (!update_accumulator(si->previous, pov, ksq))
-        return false;
+        const Delta d = src->deltas[0];
+        if (src->nb_deltas && type_of(d.piece) == KING 
+                && !same_king_bucket(pov, d.from, d.to))
+            return false;
+
+        for (int i = 0; i < src->nb_deltas; ++i)
+            n_features += (src->deltas[i].from != SQ_NONE) + (src->deltas[i].to != SQ_NONE);
+
+        // catching up would touch more weight columns than building it anew
+        if (n_features > refresh_cost)
+            return false;
 
-    si->acc.psqt[pov] = si->previous->acc.psqt[pov];
-    si->acc.v[pov] = si->previous->acc.v[pov];
+        chain[n++] = src;
+    }
 
-    if (!si->nb_deltas) {
+    if (n == 1 && update_single(*si, src->acc, pov, ksq)) {
         si->acc.computed[pov] = true;
         return true;
     }
 
-    uint16_t added[3], removed[3];
+    uint16_t features[2 * 3 * MAX_UPDATE_CHAIN], *ft = features;
+    Accumulator *dst[MAX_UPDATE_CHAIN];
+    FtSpan added[MAX_UPDATE_CHAIN], removed[MAX_UPDATE_CHAIN];
+
+    for (int ply = 0; ply < n; ++ply) {
+        StateInfo *cur = chain[n - 1 - ply];
+        dst[ply] = &cur->acc;
+
+        uint16_t *begin = ft;
+        for (int i = 0; i < cur->nb_deltas; ++i)
+            if (cur->deltas[i].to != SQ_NONE)
+                *ft++ = index(pov, cur->deltas[i].to, cur->deltas[i].piece, ksq);
+        added[ply] = FtSpan(begin, ft);
+
+        begin = ft;
+        for (int i = 0; i < cur->nb_deltas; ++i)
+            if (cur->deltas[i].from != SQ_NONE)
+                *ft++ = index(pov, cur->deltas[i].from, cur->deltas[i].piece, ksq);
+        removed[ply] = FtSpan(begin, ft);
+
+        cur->acc.computed[pov] = true;
+    }
+
+    kernels->update_chain(net, src->acc, dst, added, removed, n, pov);
+
+    return true;
+}
+
+namespace {
+
+bool refresh_from_cache(const Board &b, Accumulator &acc, Color pov, AccumulatorCache &cache) {
+    const Square ksq = b.king_square(pov);
+    const int bucket = KING_BUCKETS[ksq ^ (pov == WHITE ? 0 : 56)];
+    AccumulatorCache::Entry &e = cache.entries[pov][bucket];
+
+    if (e.net_version != NET_VERSION)
+        return false;
+
+    // more changes than pieces: a full refresh is cheaper. 
+    // Counted up front, before any feature index is computed for nothing.
+    int n_changes = 0;
+    for (Color c: { WHITE, BLACK })
+        for (PieceType pt: ALL_PTYPES)
+            n_changes += popcnt(b.pieces(c, pt) ^ e.pieces[c][pt]);
+
+    if (n_changes > popcnt(b.pieces()))
+        return false;
+
+    uint16_t added[MAX_TOTAL_FTS], removed[MAX_TOTAL_FTS];
     int n_added = 0, n_removed = 0;
 
-    for (int i = 0; i < si->nb_deltas; ++i) {
-        const Delta &d = si->deltas[i];
-        if (d.to != SQ_NONE)
-            added[n_added++] = index(pov, d.to, d.piece, ksq);
-        if (d.from != SQ_NONE)
-            removed[n_removed++] = index(pov, d.from, d.piece, ksq);
+    for (Color c: { WHITE, BLACK }) {
+        for (PieceType pt: ALL_PTYPES) {
+            Bitboard now = b.pieces(c, pt), then = e.pieces[c][pt];
+            Bitboard add = now & ~then, sub = then & ~now;
+
+            while (add)
+                added[n_added++] = index(pov, pop_lsb(add), make_piece(c, pt), ksq);
+            while (sub)
+                removed[n_removed++] = index(pov, pop_lsb(sub), make_piece(c, pt), ksq);
+
+            e.pieces[c][pt] = now;
+        }
     }
 
-    ft.update_acc(si->acc, FtSpan(added, added + n_added), 
+    kernels->update_acc(net, e.acc, FtSpan(added, added + n_added), 
             FtSpan(removed, removed + n_removed), pov);
 
-    si->acc.computed[pov] = true;
+    memcpy(acc.v[pov], e.acc.v[pov], sizeof(acc.v[pov]));
+    acc.psqt[pov] = e.acc.psqt[pov];
+
     return true;
 }
 
-void refresh_accumulator(const Board &b, Accumulator &acc, Color pov) {
+void store_in_cache(const Board &b, const Accumulator &acc, Color pov, AccumulatorCache &cache) {
+    const int bucket = KING_BUCKETS[b.king_square(pov) ^ (pov == WHITE ? 0 : 56)];
+    AccumulatorCache::Entry &e = cache.entries[pov][bucket];
+
+    memcpy(e.acc.v[pov], acc.v[pov], sizeof(acc.v[pov]));
+    e.acc.psqt[pov] = acc.psqt[pov];
+    for (Color c: { WHITE, BLACK })
+        for (PieceType pt: ALL_PTYPES)
+            e.pieces[c][pt] = b.pieces(c, pt);
+    e.net_version = NET_VERSION;
+}
+
+} // namespace
+
+void refresh_accumulator(const Board &b, Accumulator &acc, Color pov, 
+        AccumulatorCache *cache) 
+{
+    if (cache && cache->enabled && refresh_from_cache(b, acc, pov, *cache)) {
+        cache->n_cached++;
+        acc.computed[pov] = true;
+        return;
+    }
+
     uint16_t features[32];
     int n_features = get_active_features(b, pov, features);
 
-    ft.refresh_acc(acc, FtSpan(features, features + n_features), pov);
+    kernels->refresh_acc(net, acc, FtSpan(features, features + n_features), pov);
     acc.computed[pov] = true;
+
+    if (cache) {
+        cache->n_full++;
+        if (cache->enabled)
+            store_in_cache(b, acc, pov, *cache);
+    }
 }
 
-int32_t evaluate(const Board &b) {
+namespace {
+
+void check_loaded() {
     if (!NNUE_LOADED) {
         sync_cout() << "info string Attemped to evaluate "
             "without loaded nnue, aborting...\n";
         std::abort();
     }
+}
+
+int32_t output(const Accumulator &acc, Color stm, int n_pieces) {
+    int32_t result = kernels->forward(net, acc, stm, output_bucket(n_pieces));
+    return result / S_W + (acc.psqt[stm] - acc.psqt[~stm]) / 2;
+}
+
+// the positions one thread takes at a time, consecutive ones are often related
+constexpr int BATCH_SIZE = 256;
+
+} // namespace
+
+int32_t evaluate(const Board &b, AccumulatorCache *cache) {
+    check_loaded();
 
     StateInfo *si = b.get_stateinfo();
 
-    if (!update_accumulator(si, WHITE, b.king_square(WHITE)))
-        refresh_accumulator(b, si->acc, WHITE);
+    const int refresh_cost = popcnt(b.pieces());
+
+    if (!update_accumulator(si, WHITE, b.king_square(WHITE), refresh_cost))
+        refresh_accumulator(b, si->acc, WHITE, cache);
 
-    if (!update_accumulator(si, BLACK, b.king_square(BLACK)))
-        refresh_accumulator(b, si->acc, BLACK);
+    if (!update_accumulator(si, BLACK, b.king_square(BLACK), refresh_cost))
+        refresh_accumulator(b, si->acc, BLACK, cache);
 
-    Color stm = b.side_to_move();
-    int32_t result = fc_out_bias;
-    result += fc_out[0].forward(si->acc.v[stm].data());
-    result += fc_out[1].forward(si->acc.v[~stm].data());
+    return output(si->acc, b.side_to_move(), refresh_cost);
+}
+
+void evaluate_batch(const Board *boards, int n, int32_t *scores, int n_threads) {
+    check_loaded();
+    if (n <= 0)
+        return;
+
+    std::atomic<int> next{0};
+    auto work = [&] {
+        // each position is refreshed from the last one with the same king bucket
+        std::unique_ptr<AccumulatorCache> cache(new AccumulatorCache());
+        std::unique_ptr<Accumulator> acc(new Accumulator());
+
+        for (int begin; (begin = next.fetch_add(BATCH_SIZE)) < n; ) {
+            for (int i = begin; i < std::min(n, begin + BATCH_SIZE); ++i) {
+                refresh_accumulator(boards[i], *acc, WHITE, cache.get());
+                refresh_accumulator(boards[i], *acc, BLACK, cache.get());
+                scores[i] = output(*acc, boards[i].side_to_move(), popcnt(boards[i].pieces()));
+            }
+        }
+    };
+
+    n_threads = std::clamp(n_threads, 1, (n + BATCH_SIZE - 1) / BATCH_SIZE);
 
-    return result / S_W + (si->acc.psqt[stm] - si->acc.psqt[~stm]) / 2;
+    std::vector<std::thread> threads;
+    for (int i = 1; i < n_threads; ++i)
+        threads.emplace_back(work);
+
+    work();
+
+    for (auto &t: threads)
+        t.join();
 }
 
-bool load_parameters(const char *path) {
+bool load_parameters(const char *path, bool int8) {
     std::ifstream fin(path, std::ios::binary);
     if (!fin.is_open()) {
         sync_cout() << "info string Failed to open weights file\n";
-        NNUE_LOADED = false;
         return false;
     }
 
-    return detail::load_parameters(fin);
+    // the loaders quantise for the kernels in use, a failed load keeps the old ones
+    const Kernels *previous = kernels;
+    kernels = best_kernels(int8);
+
+    bool ok;
+    char magic[sizeof(RAW_NET_MAGIC)];
+    if (fin.read(magic, sizeof(magic)) && !memcmp(magic, RAW_NET_MAGIC, sizeof(magic))) {
+        ok = detail::load_raw(path);
+    } else {
+        fin.clear();
+        fin.seekg(0);
+        ok = detail::load_parameters(fin);
+    }
+
+    if (!ok)
+        kernels = previous;
+    return ok;
+}
+
+bool load_builtin(bool reference) {
+    return detail::load_compressed(g_netData, g_netSize, reference);
+}
+
+bool load_compressed(const char *path) {
+    std::ifstream fin(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(fin)), 
+            std::istreambuf_iterator<char>());
+
+    return fin.is_open() && detail::load_compressed(data.data(), data.size());
+}
+
+namespace {
+
+// small random weights, enough to time the layers
+template<typename L, typename... Rest>
+void randomise(StackParams<L, Rest...> &p, std::mt19937_64 &rng) {
+    std::uniform_int_distribution<int> dist(-16, 16);
+    auto &w = p.layer;
+
+    if constexpr (L::KIND == LayerKind::LINEAR_OUTPUT) {
+        for (auto &half: w.out_weight)
+            for (int16_t &x: half)
+                x = int16_t(dist(rng));
+        w.out_bias = 0;
+    } else if constexpr (L::KIND == LayerKind::AFFINE || L::KIND == LayerKind::SPARSE_AFFINE) {
+        for (int o = 0; o < L::N_OUT; ++o) {
+            w.bias[o] = 0;
+            for (int i = 0; i < L::N_IN; ++i)
+                w.weight[L::weight_index(o, i)] = int8_t(dist(rng));
+        }
+    }
+
+    if constexpr (sizeof...(Rest) > 0)
+        randomise(p.next, rng);
+}
+
+template<typename L>
+std::string layer_name() {
+    constexpr const char *names[] = { "linear", "affine", "sparse", "crelu" };
+    std::string s = names[int(L::KIND)] + (" " + std::to_string(L::N_IN));
+    if (L::KIND != LayerKind::CLIPPED_RELU)
+        s += "x" + std::to_string(L::N_OUT);
+    return s;
+}
+
+template<typename... Layers>
+struct Describe {
+    static std::string name() {
+        std::string s = "transformer " + std::to_string(N_FEATURES) 
+            + "x" + std::to_string(N_HIDDEN) + "x2";
+        ((s += " -> " + layer_name<Layers>()), ...);
+        return s;
+    }
+};
+
+} // namespace
+
+bool load_random(uint64_t seed) {
+    std::vector<int16_t> unpacked;
+    if (!detail::unpack(g_netData, g_netSize, unpacked, false))
+        return false;
+
+    detail::membuf buf((char*)unpacked.data(), (char*)(unpacked.data() + unpacked.size()));
+    std::istream is(&buf);
+    if (!detail::read_transformer(is, params))
+        return false;
+
+    std::mt19937_64 rng(seed);
+    for (auto &head: params.head)
+        randomise(head, rng);
+
+    use_params(&params);
+    unmap_previous();
+
+    return true;
+}
+
+const char* architecture_name() {
+    static const std::string name = Architecture::apply<Describe>::name();
+    return name.c_str();
+}
+
+bool save_raw(const char *path) {
+    if (!NNUE_LOADED)
+        return false;
+
+    RawNetHeader h{};
+    memcpy(h.magic, RAW_NET_MAGIC, sizeof(h.magic));
+    h.version = RAW_NET_VERSION;
+    h.n_features = N_FEATURES;
+    h.n_hidden = N_HIDDEN;
+    h.params_size = sizeof(NetParams);
+    h.arch_hash = Architecture::HASH;
+
+    char header[RAW_NET_OFFSET]{};
+    memcpy(header, &h, sizeof(h));
+
+    std::ofstream fout(path, std::ios::binary);
+    return fout.write(header, sizeof(header))
+        && fout.write((const char*)active_params, sizeof(NetParams));
+}
+
+
+namespace {
+
+// plain C++, the reference for all the SIMD kernels
+
+int weight_scalar(bool int8, uint16_t idx, int i) {
+    return int8 ? net.ft_weight8[N_HIDDEN * idx + i] * net.ft_scale 
+        : net.ft_weight[N_HIDDEN * idx + i];
+}
+
+void update_acc_scalar(bool int8, Accumulator &acc, FtSpan add, FtSpan sub, Color pov) {
+    for (uint16_t idx: add) {
+        for (int i = 0; i < N_HIDDEN; ++i)
+            acc.v[pov][i] += weight_scalar(int8, idx, i);
+        acc.psqt[pov] += net.ft_psqt[idx];
+    }
+
+    for (uint16_t idx: sub) {
+        for (int i = 0; i < N_HIDDEN; ++i)
+            acc.v[pov][i] -= weight_scalar(int8, idx, i);
+        acc.psqt[pov] -= net.ft_psqt[idx];
+    }
+}
+
+// the hidden layers over int32 activations
+template<typename L, typename... Rest>
+int32_t stack_scalar(const StackParams<L, Rest...> &p, const std::vector<int32_t> &in) {
+    std::vector<int32_t> out(L::N_OUT);
+    const auto &w = p.layer;
+
+    for (int o = 0; o < L::N_OUT; ++o) {
+        if constexpr (L::KIND == LayerKind::AFFINE || L::KIND == LayerKind::SPARSE_AFFINE) {
+            out[o] = w.bias[o];
+            for (int i = 0; i < L::N_IN; ++i)
+                out[o] += in[i] * w.weight[L::weight_index(o, i)];
+        } else if constexpr (L::KIND == LayerKind::CLIPPED_RELU) {
+            out[o] = std::clamp(in[o] >> WEIGHT_SHIFT, 0, 127);
+        }
+    }
+
+    if constexpr (sizeof...(Rest) == 0)
+        return out[0];
+    else
+        return stack_scalar(p.next, out);
+}
+
+int32_t forward_scalar(bool int8, const Accumulator &acc, Color stm, int bucket) {
+    if (!Architecture::LINEAR) {
+        std::vector<int32_t> x(2 * N_HIDDEN);
+        for (int i = 0; i < N_HIDDEN; ++i) {
+            x[i] = std::clamp<int16_t>(acc.v[stm][i], 0, S_A) >> 1;
+            x[N_HIDDEN + i] = std::clamp<int16_t>(acc.v[~stm][i], 0, S_A) >> 1;
+        }
+        return stack_scalar(net.head[bucket], x);
+    }
+
+    int32_t sum = 0;
+    for (int i = 0; i < N_HIDDEN; ++i) {
+        int32_t x_stm = std::clamp<int16_t>(acc.v[stm][i], 0, S_A);
+        int32_t x_nstm = std::clamp<int16_t>(acc.v[~stm][i], 0, S_A);
+        if (int8) {
+            sum += (x_stm >> 1) * net.out_weight8[bucket][0][i] 
+                + (x_nstm >> 1) * net.out_weight8[bucket][1][i];
+        } else {
+            sum += x_stm * net.out_weight[bucket][0][i] + x_nstm * net.out_weight[bucket][1][i];
+        }
+    }
+    return net.out_bias[bucket] + (int8 ? 2 * net.out_scale * sum : sum);
 }
 
+} // namespace
+
+int check_kernels(const Kernels &k, int n_trials, uint64_t seed) {
+    if (k.int8 && NNUE_LOADED)
+        quantise_net();
+
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<int> acc_dist(-3 * S_A, 3 * S_A);
+    std::uniform_int_distribution<int> ft_dist(0, N_FEATURES - 1);
+    std::uniform_int_distribution<int> n_dist(0, MAX_TOTAL_FTS);
+    std::uniform_int_distribution<int> bucket_dist(0, N_OUTPUT_BUCKETS - 1);
+
+    int n_errors = 0;
+    Accumulator simd, scalar;
+
+    for (int t = 0; t < n_trials; ++t) {
+        for (Color c: { WHITE, BLACK }) {
+            for (int i = 0; i < N_HIDDEN; ++i)
+                simd.v[c][i] = int16_t(acc_dist(rng));
+            simd.psqt[c] = acc_dist(rng);
+        }
+        scalar = simd;
+
+        const int bucket = bucket_dist(rng);
+        for (Color c: { WHITE, BLACK })
+            n_errors += k.forward(net, simd, c, bucket) != forward_scalar(k.int8, scalar, c, bucket);
+
+        uint16_t added[MAX_TOTAL_FTS], removed[MAX_TOTAL_FTS];
+        // at least 2 of each for the fused kernels
+        int n_added = std::max(2, n_dist(rng)), n_removed = std::max(2, n_dist(rng));
+        for (int i = 0; i < n_added; ++i) added[i] = uint16_t(ft_dist(rng));
+        for (int i = 0; i < n_removed; ++i) removed[i] = uint16_t(ft_dist(rng));
+
+        FtSpan add(added, added + n_added), sub(removed, removed + n_removed);
+        for (Color c: { WHITE, BLACK }) {
+            k.update_acc(net, simd, add, sub, c);
+            update_acc_scalar(k.int8, scalar, add, sub, c);
+            n_errors += memcmp(simd.v[c], scalar.v[c], sizeof(simd.v[c])) 
+                || simd.psqt[c] != scalar.psqt[c];
+        }
+
+        for (int shape = 0; shape < N_SHAPES; ++shape) {
+            const int n_add = SHAPE_ADDS[shape], n_sub = SHAPE_SUBS[shape];
+            Accumulator fused;
+            for (Color c: { WHITE, BLACK }) {
+                k.update_fused[shape](net, simd, fused, added, removed, c);
+                update_acc_scalar(k.int8, scalar, FtSpan(added, added + n_add), 
+                        FtSpan(removed, removed + n_sub), c);
+                n_errors += memcmp(fused.v[c], scalar.v[c], sizeof(fused.v[c])) 
+                    || fused.psqt[c] != scalar.psqt[c];
+            }
+            simd = scalar;
+        }
+    }
+
+    return n_errors;
+}
 
 } // mini
 
@@ -3,16 +3,90 @@
 
 #include "../primitives/common.hpp"
 #include "state.hpp"
+#include "../primitives/bitboard.hpp"
 
 class Board;
 
 namespace mini {
 
-bool update_accumulator( StateInfo *si, Color pov, Square ksq);
-void refresh_accumulator(const Board &b, Accumulator &acc, Color pov);
+/*
+ * "Finny table": for every perspective and king bucket the accumulator 
+ * of the last refresh there and the pieces it was computed from. 
+ * A refresh then only adds and removes the pieces that differ,
+ * which after a king walk across a bucket boundary is a handful instead of all of them.
+ * Kept per search thread.
+ * */
+struct AccumulatorCache {
+    struct Entry {
+        Accumulator acc;
+        Bitboard pieces[COLOR_NB][PIECE_TYPE_NB];
+        uint32_t net_version = 0;
+    };
 
-int32_t evaluate(const Board &b);
-bool load_parameters(const char *path);
+    Entry entries[COLOR_NB][N_KING_BUCKETS];
+    // when off, every refresh is a full one, but still counted
+    bool enabled = true;
+
+    // refreshes from scratch and from a cached accumulator
+    uint64_t n_full = 0, n_cached = 0;
+};
+
+// longest run of unevaluated plies update_accumulator catches up, beyond it refreshes
+constexpr int MAX_UPDATE_CHAIN = 64;
+
+/*
+ * Walks back to the nearest ply with a computed accumulator and applies 
+ * the deltas of all the plies in between in one pass, filling their accumulators too.
+ * Gives up when a king changed its bucket or when that's more features
+ * than refresh_cost, the number of features a refresh would add.
+ * */
+bool update_accumulator(StateInfo *si, Color pov, Square ksq, int refresh_cost);
+void refresh_accumulator(const Board &b, Accumulator &acc, Color pov, 
+        AccumulatorCache *cache = nullptr);
+
+int32_t evaluate(const Board &b, AccumulatorCache *cache = nullptr);
+
+/*
+ * Evaluates n positions without StateInfo chains, e.g. to score datasets, 
+ * from their side to move, on n_threads threads. The positions are split 
+ * into batches and each thread refreshes a position through its own AccumulatorCache, 
+ * from the last one with the same king bucket, so following positions of a game 
+ * cost a few features instead of all of them. Gives the same scores as evaluate.
+ * */
+void evaluate_batch(const Board *boards, int n, int32_t *scores, int n_threads = 1);
+
+/*
+ * Loads the net from a file, either raw (see save_raw), which is mapped 
+ * and used in place, or the plain int16 parameters, which are copied.
+ * With int8 the weights are quantised to int8 and evaluate goes through the int8 kernels:
+ * half the memory traffic of the accumulator updates for a slightly different eval.
+ * */
+bool load_parameters(const char *path, bool int8 = false);
+// Loads a net in the compressed format of the builtin one
+bool load_compressed(const char *path);
+// Decodes the builtin net again, with the old bit by bit decoder if reference
+bool load_builtin(bool reference = false);
+// Writes the loaded net in the raw format: a header and the parameters as they are in memory
+bool save_raw(const char *path);
+/*
+ * Loads the transformer of the builtin net with random weights for the layers after it,
+ * to time an architecture there is no trained net for yet, see arch.hpp
+ * */
+bool load_random(uint64_t seed);
+// The compiled layers, e.g. "transformer 3072x512x2 -> linear 1024x1"
+const char* architecture_name();
+// Switches between the int16 and the int8 weights of the loaded net. 
+// Accumulators computed before are stale.
+void use_int8(bool int8);
+
+struct Kernels;
+
+// the kernel set picked for this CPU at startup
+const char* kernels_name();
+
+// Runs a kernel set on the loaded net with random inputs and compares it 
+// with plain C++. Returns the number of mismatches, there should be none.
+int check_kernels(const Kernels &k, int n_trials, uint64_t seed);
 
 
 } // mini
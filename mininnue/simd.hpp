@@ -4,17 +4,117 @@
 
 #define RESTRICT __restrict
 
-#if defined(__AVX2__)
+/*
+ * A kernel translation unit is told its target by CMakeLists.txt through KERNEL_ISA_*, 
+ * MSVC doesn't define the __AVX2__ and __AVX512*__ macros without /arch and has 
+ * no VNNI switch at all. Anything else goes by what the compiler targets.
+ * */
+#if defined(KERNEL_ISA_AVX512VNNI)
+#define USE_AVX512
+#define USE_VNNI
+#elif defined(KERNEL_ISA_AVX512)
+#define USE_AVX512
+#elif defined(KERNEL_ISA_AVX2)
+#define USE_AVX2
+#elif defined(KERNEL_ISA_SSSE3)
+#define USE_SSSE3
+#elif defined(__AVX512BW__)
+#define USE_AVX512
+#if defined(__AVX512VNNI__)
+#define USE_VNNI
+#endif
+#elif defined(__AVX2__)
 #define USE_AVX2
 #else 
 #define USE_SSSE3
 #endif
 
-#if defined(USE_AVX2)
+/*
+ * Each kernel translation unit gets its own namespace, 
+ * so that the same templates compiled for different targets don't collide
+ * */
+#if defined(USE_AVX512) && defined(USE_VNNI)
+#define SIMD_NS avx512vnni
+#elif defined(USE_AVX512)
+#define SIMD_NS avx512
+#elif defined(USE_AVX2)
+#define SIMD_NS avx2
+#else
+#define SIMD_NS ssse3
+#endif
+
+#if defined(USE_AVX512)
+
+constexpr int SIMD_REGISTERS = 32;
+constexpr int SIMD_ALIGN = 64;
+constexpr int simd_reg_width = 512;
+#if defined(USE_VNNI)
+constexpr const char *SIMD_ARCH = "avx512vnni";
+constexpr const char *SIMD_ARCH_INT8 = "avx512vnni-int8";
+#else
+constexpr const char *SIMD_ARCH = "avx512";
+constexpr const char *SIMD_ARCH_INT8 = "avx512-int8";
+#endif
+
+using SIMDVector = __m512i;
+
+#define vec_add_epi32 _mm512_add_epi32
+
+#define vec_add_epi16 _mm512_add_epi16
+#define vec_sub_epi16 _mm512_sub_epi16
+#define vec_madd_epi16 _mm512_madd_epi16
+#define vec_mullo_epi16 _mm512_mullo_epi16
+#define vec_srli_epi16 _mm512_srli_epi16
+
+#define vec_set1_epi16 _mm512_set1_epi16
+#define vec_set1_epi32 _mm512_set1_epi32
+
+#define vec_min_epi16 _mm512_min_epi16
+#define vec_max_epi16 _mm512_max_epi16
+
+// acc + madd(a, b) in a single instruction
+#if defined(USE_VNNI)
+#define vec_dpwssd_epi32 _mm512_dpwssd_epi32
+#else
+#define vec_dpwssd_epi32(acc, a, b) _mm512_add_epi32(acc, _mm512_madd_epi16(a, b))
+#endif
+
+// acc + the sums of 4 products of unsigned a and signed b bytes,
+// maddubs saturates but stays exact for a <= 128 and |b| <= 127
+#if defined(USE_VNNI)
+#define vec_dpbusd_epi32 _mm512_dpbusd_epi32
+#else
+#define vec_dpbusd_epi32(acc, a, b) _mm512_add_epi32(acc, \
+        _mm512_madd_epi16(_mm512_maddubs_epi16(a, b), _mm512_set1_epi16(1)))
+#endif
+
+// a register worth of int8 widened to int16
+static inline __m512i vec_load_epi8_epi16(const int8_t *p) {
+    return _mm512_cvtepi8_epi16(_mm256_load_si256((const __m256i*)p));
+}
+
+// packus works within 128-bit lanes, the permute restores the order of a and b
+static inline __m512i vec_packus_epi16(__m512i a, __m512i b) {
+    return _mm512_permutexvar_epi64(_mm512_setr_epi64(0, 2, 4, 6, 1, 3, 5, 7), 
+            _mm512_packus_epi16(a, b));
+}
+
+// a bit for every int32 lane that isn't zero
+static inline unsigned vec_nz_mask_epi32(__m512i x) {
+    return _mm512_test_epi32_mask(x, x);
+}
+
+static inline int32_t vec_hsum_epi32(__m512i x) {
+    return _mm512_reduce_add_epi32(x);
+}
+
+#elif defined(USE_AVX2)
 
 constexpr int SIMD_REGISTERS = 16;
 constexpr int SIMD_ALIGN = 32;
 constexpr int simd_reg_width = 256;
+constexpr const char *SIMD_ARCH = "avx2";
+constexpr const char *SIMD_ARCH_INT8 = "avx2-int8";
 
 using SIMDVector = __m256i;
 
@@ -23,14 +123,46 @@ using SIMDVector = __m256i;
 #define vec_add_epi16 _mm256_add_epi16
 #define vec_sub_epi16 _mm256_sub_epi16
 #define vec_madd_epi16 _mm256_madd_epi16
-#define vec_hadd_epi32 _mm256_hadd_epi32
+#define vec_mullo_epi16 _mm256_mullo_epi16
+#define vec_srli_epi16 _mm256_srli_epi16
 
 #define vec_set1_epi16 _mm256_set1_epi16
+#define vec_set1_epi32 _mm256_set1_epi32
 
 #define vec_min_epi16 _mm256_min_epi16
 #define vec_max_epi16 _mm256_max_epi16
 
-inline int32_t vec_hsum_epi32(__m256i x) {
+#if defined(__AVXVNNI__)
+#define vec_dpwssd_epi32 _mm256_dpwssd_avx_epi32
+#elif defined(__AVX512VNNI__) && defined(__AVX512VL__)
+#define vec_dpwssd_epi32 _mm256_dpwssd_epi32
+#else
+#define vec_dpwssd_epi32(acc, a, b) _mm256_add_epi32(acc, _mm256_madd_epi16(a, b))
+#endif
+
+#if defined(__AVXVNNI__)
+#define vec_dpbusd_epi32 _mm256_dpbusd_avx_epi32
+#elif defined(__AVX512VNNI__) && defined(__AVX512VL__)
+#define vec_dpbusd_epi32 _mm256_dpbusd_epi32
+#else
+#define vec_dpbusd_epi32(acc, a, b) _mm256_add_epi32(acc, \
+        _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), _mm256_set1_epi16(1)))
+#endif
+
+static inline __m256i vec_load_epi8_epi16(const int8_t *p) {
+    return _mm256_cvtepi8_epi16(_mm_load_si128((const __m128i*)p));
+}
+
+static inline __m256i vec_packus_epi16(__m256i a, __m256i b) {
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0b11'01'10'00);
+}
+
+static inline unsigned vec_nz_mask_epi32(__m256i x) {
+    __m256i zero = _mm256_cmpeq_epi32(x, _mm256_setzero_si256());
+    return ~_mm256_movemask_ps(_mm256_castsi256_ps(zero)) & 0xFF;
+}
+
+static inline int32_t vec_hsum_epi32(__m256i x) {
     __m128i lo128 = _mm256_castsi256_si128(x);
     __m128i hi128 = _mm256_extracti128_si256(x, 1);
 
@@ -50,6 +182,8 @@ inline int32_t vec_hsum_epi32(__m256i x) {
 constexpr int SIMD_REGISTERS = 8;
 constexpr int SIMD_ALIGN = 16;
 constexpr int simd_reg_width = 128;
+constexpr const char *SIMD_ARCH = "ssse3";
+constexpr const char *SIMD_ARCH_INT8 = "ssse3-int8";
 
 using SIMDVector = __m128i;
 
@@ -59,14 +193,33 @@ using SIMDVector = __m128i;
 #define vec_sub_epi16 _mm_sub_epi16
 
 #define vec_madd_epi16 _mm_madd_epi16
-#define vec_hadd_epi32 _mm_hadd_epi32
+#define vec_mullo_epi16 _mm_mullo_epi16
+#define vec_srli_epi16 _mm_srli_epi16
 
 #define vec_set1_epi16 _mm_set1_epi16
+#define vec_set1_epi32 _mm_set1_epi32
 
 #define vec_min_epi16 _mm_min_epi16
 #define vec_max_epi16 _mm_max_epi16
 
-inline int32_t vec_hsum_epi32(__m128i sum128) {
+#define vec_dpwssd_epi32(acc, a, b) _mm_add_epi32(acc, _mm_madd_epi16(a, b))
+#define vec_dpbusd_epi32(acc, a, b) _mm_add_epi32(acc, \
+        _mm_madd_epi16(_mm_maddubs_epi16(a, b), _mm_set1_epi16(1)))
+
+// no pmovsxbw before SSE4.1: duplicate the bytes and shift the copy in the low half out
+static inline __m128i vec_load_epi8_epi16(const int8_t *p) {
+    __m128i x = _mm_loadl_epi64((const __m128i*)p);
+    return _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+}
+
+#define vec_packus_epi16 _mm_packus_epi16
+
+static inline unsigned vec_nz_mask_epi32(__m128i x) {
+    __m128i zero = _mm_cmpeq_epi32(x, _mm_setzero_si128());
+    return ~_mm_movemask_ps(_mm_castsi128_ps(zero)) & 0xF;
+}
+
+static inline int32_t vec_hsum_epi32(__m128i sum128) {
     __m128i hi64 = _mm_unpackhi_epi64(sum128, sum128);
     __m128i sum64 = _mm_add_epi32(hi64, sum128);
 
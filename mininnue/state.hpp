@@ -1,19 +1,25 @@
 #ifndef STATE_HPP
 #define STATE_HPP
 
-#include "simd.hpp"
 #include "../primitives/common.hpp"
-#include <array>
 
 #include <cassert>
 
 
 namespace mini {
 
+constexpr int N_KING_BUCKETS = 4;
+
+constexpr int N_FEATURES = 12 * 64 * N_KING_BUCKETS;
+constexpr int MAX_TOTAL_FTS = 32;
+
 constexpr int N_HIDDEN = 512;
 
+// enough for the widest SIMD kernels, whichever of them is picked at runtime
+constexpr int ACC_ALIGN = 64;
+
 struct Accumulator {
-    alignas(SIMD_ALIGN) std::array<int16_t, N_HIDDEN> v[2];
+    alignas(ACC_ALIGN) int16_t v[2][N_HIDDEN];
     bool computed[2]{};
     int32_t psqt[2];
 };
@@ -26,7 +32,7 @@ struct Delta {
 };
 
 struct StateInfo {
-    alignas(SIMD_ALIGN) Accumulator acc;
+    alignas(ACC_ALIGN) Accumulator acc;
 
     Delta deltas[3];
     int nb_deltas = 0;
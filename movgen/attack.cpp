@@ -100,17 +100,30 @@ constexpr Bitboard pawn_pushes_bb(Bitboard bb) {
 }
 
 AttackTables::AttackTables() {
+#if defined(USE_PEXT)
+    uint32_t offset = 0;
+    for (Square sq = SQ_A1; sq <= SQ_H8; ++sq) {
+        rook_offset[sq] = offset;
+        offset += 1u << popcnt(ROOK_MAGICS[sq].mask);
+    }
+    for (Square sq = SQ_A1; sq <= SQ_H8; ++sq) {
+        bishop_offset[sq] = offset;
+        offset += 1u << popcnt(BISHOP_MAGICS[sq].mask);
+    }
+    assert(offset == SLIDER_ATTACKS_SIZE);
+#endif
+
     for (Square sq = SQ_A1; sq <= SQ_H8; ++sq) {
         Bitboard sbb = square_bb(sq);
 
         auto f = [&](Bitboard blockers) {
-            size_t idx = ROOK_MAGICS[sq].rook_index(blockers);
+            size_t idx = slider_index<ROOK>(sq, blockers);
             attacks[idx] = gen_rook_attacks(sq, blockers);
         };
         enum_subsets(f, ROOK_MAGICS[sq].mask);
 
         auto g = [&](Bitboard blockers) {
-            size_t idx = BISHOP_MAGICS[sq].bishop_index(blockers);
+            size_t idx = slider_index<BISHOP>(sq, blockers);
             attacks[idx] = gen_bishop_attacks(sq, blockers);
         };
         enum_subsets(g, BISHOP_MAGICS[sq].mask);
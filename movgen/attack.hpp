@@ -5,8 +5,28 @@
 #include "../primitives/common.hpp"
 #include "magics.hpp"
 
+#if defined(USE_PEXT)
+#if !defined(__BMI2__)
+#error "USE_PEXT needs a BMI2 target"
+#endif
+#include <immintrin.h>
+
+// every subset of every relevant occupancy mask gets its own slot, no sharing as with magics
+constexpr int SLIDER_ATTACKS_SIZE = 102400 + 5248;
+#else
+constexpr int SLIDER_ATTACKS_SIZE = 88772;
+#endif
+
 struct AttackTables {
-    Bitboard attacks[88772];
+    Bitboard attacks[SLIDER_ATTACKS_SIZE];
+
+#if defined(USE_PEXT)
+    // where the attacks of a square start in attacks[], the rest of the index is
+    // pext(blockers, mask) with the same masks as the magics
+    uint32_t rook_offset[SQUARE_NB];
+    uint32_t bishop_offset[SQUARE_NB];
+#endif
+
     Bitboard pseudo_attacks[PIECE_TYPE_NB][SQUARE_NB];
 
     Bitboard pawn_attacks[COLOR_NB][SQUARE_NB];
@@ -28,17 +48,28 @@ Bitboard attacks_bb(Square sq) {
     return ATTACK_TABLES.pseudo_attacks[pt][sq];
 }
 
-// TODO: implement alternative version using BMI2
+template<PieceType pt>
+size_t slider_index(Square sq, Bitboard blockers) {
+    static_assert(pt == BISHOP || pt == ROOK);
+#if defined(USE_PEXT)
+    if (pt == BISHOP)
+        return ATTACK_TABLES.bishop_offset[sq] + _pext_u64(blockers, BISHOP_MAGICS[sq].mask);
+    return ATTACK_TABLES.rook_offset[sq] + _pext_u64(blockers, ROOK_MAGICS[sq].mask);
+#else
+    if (pt == BISHOP)
+        return BISHOP_MAGICS[sq].bishop_index(blockers);
+    return ROOK_MAGICS[sq].rook_index(blockers);
+#endif
+}
+
 template<PieceType pt>
 Bitboard attacks_bb(Square sq, Bitboard blockers) {
     static_assert(pt > PAWN && pt <= KING);
     switch (pt) {
     case BISHOP:
-        return ATTACK_TABLES.attacks[BISHOP_MAGICS[sq].bishop_index(
-            blockers)];
+        return ATTACK_TABLES.attacks[slider_index<BISHOP>(sq, blockers)];
     case ROOK:
-        return ATTACK_TABLES.attacks[ROOK_MAGICS[sq].rook_index(
-            blockers)];
+        return ATTACK_TABLES.attacks[slider_index<ROOK>(sq, blockers)];
     case QUEEN:
         return attacks_bb<BISHOP>(sq, blockers) 
             | attacks_bb<ROOK>(sq, blockers);
@@ -47,7 +78,6 @@ Bitboard attacks_bb(Square sq, Bitboard blockers) {
     };
 }
 
-// TODO: implement alternative version using BMI2
 inline Bitboard attacks_bb(PieceType pt, Square sq, Bitboard blockers) {
     assert(pt > PAWN && pt <= KING && is_ok(sq));
     switch (pt) {
@@ -3,6 +3,7 @@
 #include "../primitives/bitboard.hpp"
 #include "../board/board.hpp"
 #include "attack.hpp"
+#include "../primitives/cpu.hpp"
 
 
 namespace {
@@ -36,8 +37,9 @@ bool legal_ep_move(const Board &b, Square from, Square to) {
     return !bb;
 }
 
+// targets: the squares the moves may go to, for en passant the square of the captured pawn
 template<GenType T, bool IN_CHECK>
-ExtMove* pawn_legals(const Board &b, ExtMove *moves) {
+ExtMove* pawn_legals(const Board &b, ExtMove *moves, Bitboard targets) {
     Color us = b.side_to_move(), them = ~us;
     Square ksq = b.king_square(us);
     Bitboard our_pawns = b.pieces(us, PAWN);
@@ -74,6 +76,7 @@ ExtMove* pawn_legals(const Board &b, ExtMove *moves) {
 
         if (IN_CHECK)
             dsts &= check_mask;
+        dsts &= targets;
 
         Bitboard bb = dsts & my_r8;
         while ((T & TACTICAL) && bb)
@@ -100,7 +103,7 @@ ExtMove* pawn_legals(const Board &b, ExtMove *moves) {
             if (T & TACTICAL)
                 dsts |= pawn_attacks_bb(us, from) & b.pieces(them);
 
-            dsts &= line_bb(ksq, from);
+            dsts &= line_bb(ksq, from) & targets;
             
             Bitboard bb = dsts & my_r8;
             while ((T & TACTICAL) && bb)
@@ -114,7 +117,9 @@ ExtMove* pawn_legals(const Board &b, ExtMove *moves) {
 
     //branchy boiii
     Square ep = b.en_passant();
-    if ((T & TACTICAL) && ep != SQ_NONE) {
+    if ((T & TACTICAL) && ep != SQ_NONE 
+            && (targets & square_bb(make_square(file_of(ep), relative_rank(us, RANK_5))))) 
+    {
         Square to = ep;
         Bitboard rbb = relative_rank_bb(us, RANK_5),
             fbb = adjacent_files_bb(file_of(to));
@@ -135,7 +140,7 @@ ExtMove* pawn_legals(const Board &b, ExtMove *moves) {
 /*-------------------Knight moves--------------------*/
 
 template<GenType T, bool IN_CHECK>
-ExtMove* knight_legals(const Board &b, ExtMove *moves) {
+ExtMove* knight_legals(const Board &b, ExtMove *moves, Bitboard targets) {
     Color us = b.side_to_move(), them = ~us;
 
     Bitboard our_knights = b.pieces(us, KNIGHT);
@@ -150,6 +155,7 @@ ExtMove* knight_legals(const Board &b, ExtMove *moves) {
     if (IN_CHECK)
         mask &= between_bb(ksq, lsb(b.checkers()))
             | b.checkers();
+    mask &= targets;
 
     Bitboard bb = our_knights & ~pinned;
     while (bb) {
@@ -168,7 +174,7 @@ ExtMove* knight_legals(const Board &b, ExtMove *moves) {
 /*-------------------Slider moves--------------------*/
 
 template<GenType T, PieceType P, bool IN_CHECK>
-ExtMove* slider_legals(const Board &b, ExtMove *moves) {
+ExtMove* slider_legals(const Board &b, ExtMove *moves, Bitboard targets) {
     static_assert(P == BISHOP || P == ROOK || P == QUEEN);
 
     Color us = b.side_to_move(), them = ~us;
@@ -185,6 +191,7 @@ ExtMove* slider_legals(const Board &b, ExtMove *moves) {
     if (IN_CHECK)
         mask &= between_bb(ksq, lsb(b.checkers()))
             | b.checkers();
+    mask &= targets;
 
     Bitboard bb = our_sliders & ~pinned;
     while (bb) {
@@ -224,7 +231,7 @@ bool legal_king_move(const Board &b, Square to) {
 
 
 template<GenType T, bool IN_CHECK>
-ExtMove* king_legals(const Board &b, ExtMove *moves) {
+ExtMove* king_legals(const Board &b, ExtMove *moves, Bitboard targets = ~Bitboard(0)) {
     Color us = b.side_to_move(), them = ~us;
     Square from = b.king_square(us);
 
@@ -233,6 +240,7 @@ ExtMove* king_legals(const Board &b, ExtMove *moves) {
         mask |= b.pieces(them);
     if (T & NON_TACTICAL)
         mask |= ~b.pieces();
+    mask &= targets;
 
     Bitboard bb = attacks_bb<KING>(from) & mask;
     while (bb) {
@@ -243,7 +251,7 @@ ExtMove* king_legals(const Board &b, ExtMove *moves) {
 
     if (IN_CHECK)
         return moves;
-    if (!(T & NON_TACTICAL))
+    if (!(T & NON_TACTICAL) || ~targets)
         return moves;
 
     CastlingRights cr = b.castling();
@@ -267,32 +275,283 @@ ExtMove* king_legals(const Board &b, ExtMove *moves) {
 
 /*-----------------End of king moves----------------*/
 
+
+/*--------------------Quiet checks-------------------*/
+
+// What a quiet move needs to give check, computed once per position
+struct CheckInfo {
+    // the squares each piece type checks their king from
+    Bitboard check_squares[PIECE_TYPE_NB];
+    // our pieces between our slider and their king, any move off that line checks
+    Bitboard discoverers;
+    Square ksq;
+
+    explicit CheckInfo(const Board &b) {
+        Color us = b.side_to_move(), them = ~us;
+        ksq = b.king_square(them);
+        check_squares[PAWN] = pawn_attacks_bb(them, ksq);
+        check_squares[KNIGHT] = attacks_bb<KNIGHT>(ksq);
+        check_squares[BISHOP] = attacks_bb<BISHOP>(ksq, b.pieces());
+        check_squares[ROOK] = attacks_bb<ROOK>(ksq, b.pieces());
+        check_squares[QUEEN] = check_squares[BISHOP] | check_squares[ROOK];
+        check_squares[KING] = 0;
+        discoverers = b.blockers_for_king(them) & b.pieces(us);
+    }
+
+    bool quiet_gives_check(const Board &b, Move m) const {
+        Square from = from_sq(m), to = to_sq(m);
+
+        if (type_of(m) == CASTLING) {
+            // only the rook can give check
+            Square rk_to = make_square(file_of(to) == FILE_G ? FILE_F : FILE_D, rank_of(to));
+            Bitboard occupied = b.pieces() ^ square_bb(from) ^ square_bb(to)
+                ^ square_bb(make_square(file_of(to) == FILE_G ? FILE_H : FILE_A, rank_of(to)))
+                ^ square_bb(rk_to);
+            return attacks_bb<ROOK>(rk_to, occupied) & square_bb(ksq);
+        }
+
+        if (check_squares[type_of(b.piece_on(from))] & square_bb(to))
+            return true;
+
+        return (discoverers & square_bb(from)) && !(line_bb(from, ksq) & square_bb(to));
+    }
+};
+
+/*-----------------End of quiet checks---------------*/
+
+
+/*------------------Counting moves------------------*/
+
+// the promotions count 4 times
+int count_pawn_dsts(Bitboard dsts, Bitboard my_r8) {
+    return popcnt(dsts) + 3 * popcnt(dsts & my_r8);
+}
+
+// the same moves as pawn_legals<LEGAL>, the unpinned pawns all at once
+template<Color Us, bool IN_CHECK>
+int count_pawn_legals(const Board &b, Bitboard check_mask) {
+    constexpr Direction UP = Us == WHITE ? NORTH : SOUTH;
+    constexpr Direction UP_EAST = Us == WHITE ? NORTH_EAST : SOUTH_EAST;
+    constexpr Direction UP_WEST = Us == WHITE ? NORTH_WEST : SOUTH_WEST;
+
+    Square ksq = b.king_square(Us);
+    Bitboard my_r3 = relative_rank_bb(Us, RANK_3),
+             my_r8 = relative_rank_bb(Us, RANK_8);
+    Bitboard empty = ~b.pieces(), enemies = b.pieces(~Us);
+    Bitboard our_pawns = b.pieces(Us, PAWN), pinned = b.blockers_for_king(Us);
+    Bitboard pawns = our_pawns & ~pinned;
+
+    Bitboard push = shift<UP>(pawns) & empty;
+    Bitboard double_push = shift<UP>(push & my_r3) & empty;
+    int n = count_pawn_dsts(push & check_mask, my_r8) 
+        + popcnt(double_push & check_mask)
+        + count_pawn_dsts(shift<UP_EAST>(pawns) & enemies & check_mask, my_r8)
+        + count_pawn_dsts(shift<UP_WEST>(pawns) & enemies & check_mask, my_r8);
+
+    if (!IN_CHECK) {
+        pawns = our_pawns & pinned;
+        while (pawns) {
+            Square from = pop_lsb(pawns);
+
+            Bitboard dsts = pawn_pushes_bb(Us, from) & ~b.pieces();
+            Bitboard bb = (my_r3 & b.pieces()) & ~square_bb(from);
+            bb = (bb << 8) | (bb >> 8);
+            dsts &= ~bb;
+            dsts |= pawn_attacks_bb(Us, from) & enemies;
+
+            n += count_pawn_dsts(dsts & line_bb(ksq, from), my_r8);
+        }
+    }
+
+    Square ep = b.en_passant();
+    if (ep != SQ_NONE) {
+        Bitboard bb = our_pawns & relative_rank_bb(Us, RANK_5) 
+            & adjacent_files_bb(file_of(ep));
+        while (bb)
+            n += legal_ep_move(b, pop_lsb(bb), ep);
+    }
+
+    return n;
+}
+
+template<PieceType P, bool IN_CHECK>
+int count_piece_legals(const Board &b, Bitboard mask) {
+    Color us = b.side_to_move();
+    Square ksq = b.king_square(us);
+    Bitboard ours = b.pieces(us, P), pinned = b.blockers_for_king(us);
+
+    int n = 0;
+    Bitboard bb = ours & ~pinned;
+    while (bb)
+        n += popcnt(attacks_bb<P>(pop_lsb(bb), b.pieces()) & mask);
+
+    // a pinned knight can't move at all
+    if (!IN_CHECK && P != KNIGHT) {
+        bb = ours & pinned;
+        while (bb) {
+            Square from = pop_lsb(bb);
+            n += popcnt(attacks_bb<P>(from, b.pieces()) & line_bb(from, ksq) & mask);
+        }
+    }
+
+    return n;
+}
+
+template<Color Us, bool IN_CHECK>
+int count_legals(const Board &b) {
+    Bitboard check_mask = ~Bitboard(0);
+    if (IN_CHECK)
+        check_mask = between_bb(b.king_square(Us), lsb(b.checkers())) | b.checkers();
+    const Bitboard mask = ~b.pieces(Us) & check_mask;
+
+    ExtMove king_moves[MAX_MOVES];
+    return count_pawn_legals<Us, IN_CHECK>(b, check_mask)
+        + count_piece_legals<KNIGHT, IN_CHECK>(b, mask)
+        + count_piece_legals<BISHOP, IN_CHECK>(b, mask)
+        + count_piece_legals<ROOK, IN_CHECK>(b, mask)
+        + count_piece_legals<QUEEN, IN_CHECK>(b, mask)
+        + int(king_legals<LEGAL, IN_CHECK>(b, king_moves) - king_moves);
+}
+
+int count_legal_default(const Board &b) {
+    const bool white = b.side_to_move() == WHITE;
+    if (!b.checkers())
+        return white ? count_legals<WHITE, false>(b) : count_legals<BLACK, false>(b);
+
+    if (popcnt(b.checkers()) == 1)
+        return white ? count_legals<WHITE, true>(b) : count_legals<BLACK, true>(b);
+
+    ExtMove king_moves[MAX_MOVES];
+    return int(king_legals<LEGAL, true>(b, king_moves) - king_moves);
+}
+
+/*---------------End of counting moves---------------*/
+
+template<GenType T, bool IN_CHECK>
+ExtMove* all_legals(const Board &b, ExtMove *moves, Bitboard targets) {
+    moves = pawn_legals<T, IN_CHECK>(b, moves, targets);
+    moves = knight_legals<T, IN_CHECK>(b, moves, targets);
+    moves = slider_legals<T, BISHOP, IN_CHECK>(b, moves, targets);
+    moves = slider_legals<T, ROOK, IN_CHECK>(b, moves, targets);
+    moves = slider_legals<T, QUEEN, IN_CHECK>(b, moves, targets);
+    return king_legals<T, IN_CHECK>(b, moves, targets);
+}
+
+/*
+ * TACTICAL, NON_TACTICAL and LEGAL, and the staged modes on top of them:
+ * CAPTURES is TACTICAL with the victims as targets, EVASIONS skips the positions
+ * without check and QUIET_CHECKS keeps the NON_TACTICAL moves that give check
+ * */
+template<GenType T>
+ExtMove* generate_targets(const Board &b, ExtMove *moves, Bitboard targets) {
+    if constexpr (T == CAPTURES) {
+        return generate_targets<TACTICAL>(b, moves, targets & b.pieces(~b.side_to_move()));
+    } else if constexpr (T == EVASIONS) {
+        return b.checkers() ? generate_targets<LEGAL>(b, moves, targets) : moves;
+    } else if constexpr (T == QUIET_CHECKS) {
+        ExtMove *end = generate_targets<NON_TACTICAL>(b, moves, targets);
+        const CheckInfo ci(b);
+        ExtMove *last = moves;
+        for (ExtMove *it = moves; it != end; ++it)
+            if (ci.quiet_gives_check(b, *it))
+                *last++ = *it;
+        return last;
+    } else if (!b.checkers()) {
+        return all_legals<T, false>(b, moves, targets);
+    } else if (popcnt(b.checkers()) == 1) {
+        return all_legals<T, true>(b, moves, targets);
+    } else {
+        return king_legals<T, true>(b, moves, targets);
+    }
+}
+
+template<GenType T>
+ExtMove* generate_default(const Board &b, ExtMove *moves) {
+    return generate_targets<T>(b, moves, ~Bitboard(0));
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAS_BMI2_GENERATE
+
+/*
+ * The same generator with everything it calls inlined and compiled for BMI2, 
+ * so the bit twiddling becomes blsr, tzcnt and friends even in a portable build
+ * */
+template<GenType T>
+__attribute__((target("popcnt,bmi,bmi2,lzcnt"), flatten))
+ExtMove* generate_bmi2(const Board &b, ExtMove *moves) {
+    return generate_default<T>(b, moves);
+}
+
+__attribute__((target("popcnt,bmi,bmi2,lzcnt"), flatten))
+ExtMove* generate_captures_bmi2(const Board &b, ExtMove *moves, Bitboard victims) {
+    return generate_targets<CAPTURES>(b, moves, victims);
+}
+
+__attribute__((target("popcnt,bmi,bmi2,lzcnt"), flatten))
+int count_legal_bmi2(const Board &b) {
+    return count_legal_default(b);
+}
+#endif
+
+struct Generators {
+    const char *name;
+    ExtMove* (*tactical)(const Board&, ExtMove*);
+    ExtMove* (*non_tactical)(const Board&, ExtMove*);
+    ExtMove* (*legal)(const Board&, ExtMove*);
+    ExtMove* (*evasions)(const Board&, ExtMove*);
+    ExtMove* (*quiet_checks)(const Board&, ExtMove*);
+    ExtMove* (*captures)(const Board&, ExtMove*, Bitboard);
+    int (*count_legal)(const Board&);
+};
+
+Generators pick_generators() {
+#if defined(HAS_BMI2_GENERATE)
+    if (cpu_features().bmi2)
+        return { "bmi2", generate_bmi2<TACTICAL>, 
+            generate_bmi2<NON_TACTICAL>, generate_bmi2<LEGAL>, generate_bmi2<EVASIONS>,
+            generate_bmi2<QUIET_CHECKS>, generate_captures_bmi2, count_legal_bmi2 };
+#endif
+    return { "default", generate_default<TACTICAL>, 
+        generate_default<NON_TACTICAL>, generate_default<LEGAL>, generate_default<EVASIONS>,
+        generate_default<QUIET_CHECKS>, generate_targets<CAPTURES>, count_legal_default };
+}
+
+const Generators generators = pick_generators();
+
 } //namespace
 
 template ExtMove* generate<TACTICAL>(const Board&, ExtMove*);
 template ExtMove* generate<NON_TACTICAL>(const Board&, ExtMove*);
 template ExtMove* generate<LEGAL>(const Board&, ExtMove*);
+template ExtMove* generate<EVASIONS>(const Board&, ExtMove*);
+template ExtMove* generate<QUIET_CHECKS>(const Board&, ExtMove*);
+template ExtMove* generate<CAPTURES>(const Board&, ExtMove*, Bitboard);
 
 template<GenType T>
 ExtMove* generate(const Board &b, ExtMove *moves) {
-    if (!b.checkers()) {
-        moves = pawn_legals<T, false>(b, moves);
-        moves = knight_legals<T, false>(b, moves);
-        moves = slider_legals<T, BISHOP, false>(b, moves);
-        moves = slider_legals<T, ROOK, false>(b, moves);
-        moves = slider_legals<T, QUEEN, false>(b, moves);
-        moves = king_legals<T, false>(b, moves);
-    } else if (popcnt(b.checkers()) == 1) {
-        moves = pawn_legals<T, true>(b, moves);
-        moves = knight_legals<T, true>(b, moves);
-        moves = slider_legals<T, BISHOP, true>(b, moves);
-        moves = slider_legals<T, ROOK, true>(b, moves);
-        moves = slider_legals<T, QUEEN, true>(b, moves);
-        moves = king_legals<T, true>(b, moves);
-    } else {
-        moves = king_legals<T, true>(b, moves);
-    }
+    if constexpr (T == TACTICAL)
+        return generators.tactical(b, moves);
+    else if constexpr (T == NON_TACTICAL)
+        return generators.non_tactical(b, moves);
+    else if constexpr (T == EVASIONS)
+        return generators.evasions(b, moves);
+    else if constexpr (T == QUIET_CHECKS)
+        return generators.quiet_checks(b, moves);
+    else
+        return generators.legal(b, moves);
+}
 
-    return moves;
+template<GenType T>
+ExtMove* generate(const Board &b, ExtMove *moves, Bitboard victims) {
+    static_assert(T == CAPTURES);
+    return generators.captures(b, moves, victims);
 }
 
+int count_legal(const Board &b) {
+    return generators.count_legal(b);
+}
+
+const char* generator_name() {
+    return generators.name;
+}
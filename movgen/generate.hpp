@@ -2,6 +2,7 @@
 #define MOVGEN_GENERATE_HPP
 
 #include "../primitives/common.hpp"
+#include "../primitives/bitboard.hpp"
 #include <cstdint>
 
 struct ExtMove {
@@ -24,6 +25,13 @@ enum GenType {
     TACTICAL = 1, //and promotions
     NON_TACTICAL = 2,
     LEGAL = 3,
+
+    // the legal moves of a position in check, none out of check
+    EVASIONS = 4,
+    // the NON_TACTICAL moves that give check, directly or by discovery
+    QUIET_CHECKS = 8,
+    // the captures of some of their pieces only, promotions with capture included
+    CAPTURES = 16,
 };
 
 class Board;
@@ -31,4 +39,14 @@ class Board;
 template<GenType T>
 ExtMove* generate(const Board &b, ExtMove *moves);
 
+// CAPTURES of the pieces on victims, e.g. the queens first and the rest only if needed
+template<GenType T>
+ExtMove* generate(const Board &b, ExtMove *moves, Bitboard victims);
+
+// The number of moves generate<LEGAL> gives, counted with popcounts without making them
+int count_legal(const Board &b);
+
+// the generator variant picked for this CPU at startup
+const char* generator_name();
+
 #endif
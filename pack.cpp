@@ -3,6 +3,7 @@
 #include "movgen/attack.hpp"
 #include "zobrist.hpp"
 #include "movgen/generate.hpp"
+#include "mininnue/nnue.hpp"
 #include <vector>
 #include <fstream>
 #include <cstring>
@@ -727,6 +728,85 @@ bool validate_packed_games(const char *fname, uint64_t &hash_out) {
     return true;
 }
 
+bool score_packed_games(const char *fin_path, const char *fout_path, int n_threads, 
+        double *mean_error) 
+{
+    // enough positions for every thread to get many batches
+    constexpr size_t FLUSH_SIZE = 1 << 16;
+
+    ChunkHead head;
+    ChainReader cr;
+
+    std::ifstream fin(fin_path, std::ios::binary);
+    std::ofstream fout(fout_path);
+    if (!fin || !fout)
+        return false;
+
+    std::vector<uint8_t> buffer(PACK_CHUNK_SIZE + CHUNK_PADDING, 0);
+
+    std::vector<Board> boards;
+    std::vector<int16_t> pack_scores;
+    std::vector<int32_t> evals;
+    double total_error = 0;
+    size_t n_scored = 0;
+
+    auto flush = [&]() {
+        evals.resize(boards.size());
+        mini::evaluate_batch(boards.data(), int(boards.size()), evals.data(), n_threads);
+
+        char fen[128];
+        for (size_t i = 0; i < boards.size(); ++i) {
+            boards[i].get_fen(fen);
+            fout << fen << ';' << pack_scores[i] << ';' << evals[i] << '\n';
+            total_error += std::abs(evals[i] - pack_scores[i]);
+        }
+        n_scored += boards.size();
+
+        boards.clear();
+        pack_scores.clear();
+    };
+
+    while (fin) {
+        fin.read((char*)buffer.data(), PACK_CHUNK_SIZE);
+        if (!fin && fin.gcount() == 0) break;
+
+        head.from_bytes(buffer.data());
+        if (head.body_size >= PACK_CHUNK_SIZE)
+            return false;
+
+        size_t buf_size = std::min(uint32_t(fin.gcount()), head.body_size);
+        buf_size = std::min(buffer.size(), buf_size + CHUNK_PADDING);
+        const uint8_t *ptr = buffer.data() + head.SIZE;
+
+        for (uint32_t k = 0; k < head.n_chains; ++k) {
+            PackResult pr = cr.start_new_chain(ptr, buf_size);
+            if (!is_ok(pr))
+                return false;
+
+            do {
+                boards.push_back(cr.board);
+                pack_scores.push_back(cr.score);
+            } while (is_ok(pr = cr.next()));
+
+            if (pr != PackResult::END_OF_CHAIN)
+                return false;
+
+            buf_size -= cr.tellg();
+            ptr += cr.tellg();
+        }
+
+        if (boards.size() >= FLUSH_SIZE)
+            flush();
+    }
+
+    flush();
+
+    if (mean_error)
+        *mean_error = n_scored ? total_error / n_scored : 0;
+
+    return bool(fout);
+}
+
 void recover_packed_games(const char *fin_path, const char *fout_path) {
     ChunkHead head;
     ChainReader cr2;
@@ -167,6 +167,12 @@ PackedBoard pack_board(const Board &b);
 void merge_packed_games(const char **game_fnames, int n_files, const char *fout_games);
 
 bool validate_packed_games(const char *fname, uint64_t &hash_out);
+
+// Writes every scored position of the pack as a line "<fen>;<pack score>;<nnue eval>", 
+// both from the side to move. The positions are evaluated in batches on n_threads threads.
+// The mean |eval - score| over them, how well the net predicts the search, goes into mean_error.
+bool score_packed_games(const char *fin_path, const char *fout_path, int n_threads, 
+        double *mean_error = nullptr);
 void recover_packed_games(const char *fin_path, const char *fout_path);
 
 
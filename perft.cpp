@@ -3,6 +3,12 @@
 #include "board/board.hpp"
 #include <vector>
 #include <thread>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <cstring>
 
 namespace {
 
@@ -23,23 +29,272 @@ constexpr PerftResult PERFT_RESULTS[] = {
 
 constexpr int N = static_cast<int>(std::size(PERFT_RESULTS));
 
+/*
+ * Lockless like the TT: each slot is the data word and the key xor-ed with it,
+ * a torn write fails the key check and is just a miss. The data is 
+ * the count above the depth, so the same position at another depth is a miss too.
+ * */
+class PerftHash {
+public:
+    explicit PerftHash(size_t mbs) {
+        size_t n = 1;
+        while (2 * n * sizeof(Slot) <= mbs * 1024 * 1024)
+            n *= 2;
+        slots_.reset(new Slot[n]);
+        mask_ = n - 1;
+    }
+
+    bool probe(uint64_t key, int depth, uint64_t &nodes) const {
+        const Slot &s = slot(key, depth);
+        const uint64_t data = s.data.load(std::memory_order_relaxed);
+        if ((s.key.load(std::memory_order_relaxed) ^ data) != key || (data & 0xFF) != depth)
+            return false;
+        nodes = data >> 8;
+        return true;
+    }
+
+    void store(uint64_t key, int depth, uint64_t nodes) {
+        Slot &s = slot(key, depth);
+        const uint64_t data = nodes << 8 | uint64_t(depth);
+        s.data.store(data, std::memory_order_relaxed);
+        s.key.store(key ^ data, std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> key{0}, data{0};
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_ = 0;
+
+    Slot& slot(uint64_t key, int depth) const {
+        return slots_[(key ^ uint64_t(depth) * 0x9E3779B97F4A7C15ull) & mask_];
+    }
+};
+
+uint64_t perft(const Board &b, int depth, PerftHash *hash) {
+    if (!hash || depth < 2)
+        return ::perft(b, depth);
+
+    uint64_t n = 0;
+    if (hash->probe(b.key(), depth, n))
+        return n;
+
+    ExtMove begin[MAX_MOVES], *end;
+    end = generate<LEGAL>(b, begin);
+    for (auto it = begin; it != end; ++it)
+        n += perft(b.do_move(*it), depth - 1, hash);
+
+    hash->store(b.key(), depth, n);
+    return n;
+}
+
 } //namespace
 
-uint64_t perft(const Board &b, int depth) {
+namespace {
+
+uint64_t perft_copy(const Board &b, int depth) {
+    if (depth == 1)
+        return count_legal(b);
+
     ExtMove begin[MAX_MOVES], *end;
     end = generate<LEGAL>(b, begin);
 
+    uint64_t n = 0;
+    for (auto it = begin; it != end; ++it)
+        n += perft_copy(b.do_perft_move(*it), depth - 1);
+
+    return n;
+}
+
+uint64_t perft_unmake(Board &b, int depth) {
     if (depth == 1)
-        return end - begin;
+        return count_legal(b);
+
+    ExtMove begin[MAX_MOVES], *end;
+    end = generate<LEGAL>(b, begin);
 
     uint64_t n = 0;
+    UndoInfo u;
     for (auto it = begin; it != end; ++it) {
-        n += perft(b.do_move(*it), depth - 1);
+        b.make_perft_move(*it, u);
+        n += perft_unmake(b, depth - 1);
+        b.unmake_move(*it, u);
     }
 
     return n;
 }
 
+} // namespace
+
+// copy-make unless MAKE_UNMAKE (see CMakeLists.txt), perft_bench times both
+uint64_t perft(const Board &b, int depth) {
+#if defined(MAKE_UNMAKE)
+    Board copy = b;
+    return perft_unmake(copy, depth);
+#else
+    return perft_copy(b, depth);
+#endif
+}
+
+uint64_t perft(const Board &b, int depth, int n_threads, size_t hash_mb,
+        std::vector<PerftDivide> *divide) 
+{
+    struct Work {
+        Board board;
+        int root;
+    };
+
+    ExtMove root_moves[MAX_MOVES];
+    const int n_root = int(generate<LEGAL>(b, root_moves) - root_moves);
+
+    // the positions 2 plies deep, or the root moves themselves below depth 3
+    const int split = depth >= 3 ? 2 : 1;
+    std::vector<Work> work;
+    for (int i = 0; i < n_root; ++i) {
+        const Board child = b.do_move(root_moves[i]);
+        if (split == 1) {
+            work.push_back({ child, i });
+            continue;
+        }
+
+        ExtMove replies[MAX_MOVES];
+        ExtMove *end = generate<LEGAL>(child, replies);
+        for (ExtMove *it = replies; it != end; ++it)
+            work.push_back({ child.do_move(*it), i });
+    }
+
+    std::unique_ptr<PerftHash> hash(hash_mb ? new PerftHash(hash_mb) : nullptr);
+    std::unique_ptr<std::atomic<uint64_t>[]> root_nodes(new std::atomic<uint64_t>[n_root]{});
+
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t i; (i = next.fetch_add(1)) < work.size(); ) {
+            const uint64_t n = depth == split ? 1 : perft(work[i].board, depth - split, hash.get());
+            root_nodes[work[i].root].fetch_add(n, std::memory_order_relaxed);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < n_threads; ++i)
+        threads.emplace_back(worker);
+    worker();
+    for (auto &t: threads)
+        t.join();
+
+    uint64_t total = 0;
+    if (divide)
+        divide->clear();
+    for (int i = 0; i < n_root; ++i) {
+        total += root_nodes[i];
+        if (divide)
+            divide->push_back({ root_moves[i], root_nodes[i] });
+    }
+
+    return total;
+}
+
+namespace {
+
+std::vector<Move> sorted_moves(const ExtMove *begin, const ExtMove *end) {
+    std::vector<Move> moves(begin, end);
+    std::sort(moves.begin(), moves.end());
+    return moves;
+}
+
+// the staged modes of one position against the LEGAL moves filtered by what each mode is
+uint64_t check_generators(const Board &b) {
+    ExtMove legal[MAX_MOVES], moves[MAX_MOVES];
+    ExtMove *legal_end = generate<LEGAL>(b, legal);
+    uint64_t n_errors = 0;
+
+    auto expect = [&](ExtMove *end, auto &&belongs) {
+        std::vector<Move> expected;
+        for (ExtMove *it = legal; it != legal_end; ++it)
+            if (belongs(Move(*it)))
+                expected.push_back(*it);
+        std::sort(expected.begin(), expected.end());
+        n_errors += sorted_moves(moves, end) != expected;
+    };
+
+    expect(generate<EVASIONS>(b, moves), [&](Move) { return b.checkers() != 0; });
+
+    expect(generate<QUIET_CHECKS>(b, moves), [&](Move m) {
+        return b.is_quiet(m) && b.do_move(m).checkers();
+    });
+
+    const Color them = ~b.side_to_move();
+    const Bitboard victim_sets[] = {
+        b.pieces(them, QUEEN), b.pieces(them, ROOK), 
+        b.pieces(them, KNIGHT, BISHOP), b.pieces(them, PAWN), b.pieces(them),
+    };
+    for (Bitboard victims: victim_sets) {
+        expect(generate<CAPTURES>(b, moves, victims), [&](Move m) {
+            Square cap_sq = type_of(m) == EN_PASSANT 
+                ? make_square(file_of(to_sq(m)), rank_of(from_sq(m))) : to_sq(m);
+            return type_of(m) != CASTLING && (victims & square_bb(cap_sq));
+        });
+    }
+
+    return n_errors;
+}
+
+bool same_position(const Board &a, const Board &b) {
+    char fen_a[128], fen_b[128];
+    a.get_fen(fen_a);
+    b.get_fen(fen_b);
+    return !strcmp(fen_a, fen_b) && a.key() == b.key() && a.mat_key() == b.mat_key()
+        && a.checkers() == b.checkers() && a.is_valid()
+        && a.blockers_for_king(WHITE) == b.blockers_for_king(WHITE)
+        && a.blockers_for_king(BLACK) == b.blockers_for_king(BLACK);
+}
+
+uint64_t check_generators(const Board &b, int depth) {
+    uint64_t n_errors = check_generators(b);
+    if (depth == 0)
+        return n_errors;
+
+    ExtMove begin[MAX_MOVES], *end;
+    end = generate<LEGAL>(b, begin);
+    for (auto it = begin; it != end; ++it) {
+        const Board child = b.do_move(*it);
+
+        // make_move gives the same position and unmake_move takes it back exactly
+        Board made = b;
+        UndoInfo u;
+        made.make_move(*it, u);
+        n_errors += !same_position(made, child);
+        made.unmake_move(*it, u);
+        n_errors += !same_position(made, b);
+
+        n_errors += check_generators(child, depth - 1);
+    }
+
+    return n_errors;
+}
+
+} // namespace
+
+int perft_check_generators(int depth) {
+    int n_failed = 0;
+    for (int i = 0; i < N; ++i) {
+        PerftResult pr = PERFT_RESULTS[i];
+        Board b;
+        if (!b.load_fen(pr.fen))
+            return -1;
+
+        const int d = std::min(depth, pr.depth - 1);
+        const uint64_t n_errors = check_generators(b, d);
+        n_failed += n_errors != 0;
+
+        printf("#%d depth %d %llu wrong positions\n", i + 1, d, 
+                (unsigned long long)n_errors);
+    }
+
+    return n_failed;
+}
+
 int perft_test_positions() {
     uint64_t results[N]{};
     std::vector<std::thread> threads;
@@ -66,3 +321,51 @@ int perft_test_positions() {
     return 0;
 }
 
+
+int perft_bench(int max_positions, int n_threads, size_t hash_mb) {
+    using namespace std::chrono;
+
+    // single-threaded both ways of making moves, see perft
+    const bool split = n_threads > 1 || hash_mb;
+    uint64_t total_nodes = 0;
+    double total_secs[2]{};
+    int n_failed = 0;
+
+    for (int i = 0; i < std::min(N, max_positions); ++i) {
+        PerftResult pr = PERFT_RESULTS[i];
+        Board b;
+        if (!b.load_fen(pr.fen))
+            return -1;
+
+        double secs[2]{};
+        uint64_t nodes[2]{};
+        for (int unmake = 0; unmake < (split ? 1 : 2); ++unmake) {
+            Board copy = b;
+            auto start = steady_clock::now();
+            nodes[unmake] = split ? perft(b, pr.depth, n_threads, hash_mb) 
+                : unmake ? perft_unmake(copy, pr.depth) : perft_copy(b, pr.depth);
+            secs[unmake] = duration<double>(steady_clock::now() - start).count();
+            total_secs[unmake] += secs[unmake];
+        }
+
+        bool ok = nodes[0] == pr.nodes && (split || nodes[1] == pr.nodes);
+        n_failed += !ok;
+        total_nodes += pr.nodes;
+
+        printf("#%d depth %d nodes %11llu %s %8.2f Mnps", i + 1, pr.depth,
+                (unsigned long long)nodes[0], ok ? "ok  " : "FAIL", nodes[0] / secs[0] * 1e-6);
+        if (!split)
+            printf(", make/unmake %8.2f Mnps", nodes[1] / secs[1] * 1e-6);
+        printf("\n");
+    }
+
+    printf("total %llu nodes in %.2f s, %.2f Mnps", (unsigned long long)total_nodes,
+            total_secs[0], total_nodes / total_secs[0] * 1e-6);
+    if (!split) {
+        printf(", make/unmake in %.2f s, %.2f Mnps", 
+                total_secs[1], total_nodes / total_secs[1] * 1e-6);
+    }
+    printf("\n");
+
+    return n_failed;
+}
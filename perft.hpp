@@ -1,11 +1,39 @@
 #ifndef PERFT_HPP
 #define PERFT_HPP
 
+#include "primitives/common.hpp"
 #include <cstdint>
+#include <cstddef>
+#include <vector>
 
 class Board;
 
 uint64_t perft(const Board &b, int depth);
 int perft_test_positions();
 
+struct PerftDivide {
+    Move move;
+    uint64_t nodes;
+};
+
+/*
+ * perft on n_threads threads. The positions 2 plies from the root are handed out
+ * one at a time, so a thread done with a small subtree takes the next one
+ * while the others are still in big ones. With hash_mb > 0 the threads share 
+ * a lockless table of (position, depth) -> count. Fills divide, when given, 
+ * with the count of every root move in generation order.
+ * */
+uint64_t perft(const Board &b, int depth, int n_threads, size_t hash_mb,
+        std::vector<PerftDivide> *divide = nullptr);
+
+// Walks the test positions down to depth and checks the staged generator modes 
+// (EVASIONS, QUIET_CHECKS, CAPTURES) at every node against LEGAL, and make_move 
+// and unmake_move against do_move. Returns the number of positions with a mismatch.
+int perft_check_generators(int depth);
+
+// Run over the test positions, printing the speed of each,
+// single-threaded with both copy-make and make/unmake.
+// Returns the number of wrong node counts.
+int perft_bench(int max_positions, int n_threads = 1, size_t hash_mb = 0);
+
 #endif
@@ -306,8 +306,8 @@ struct Span {
     Span(T *begin, T *end)
         : begin_(begin), end_(end) {}
 
-    T* begin() { return begin_; }
-    T* end() { return end_; }
+    T* begin() const { return begin_; }
+    T* end() const { return end_; }
 
     size_t size() const { return end_ - begin_; }
 
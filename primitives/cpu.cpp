@@ -0,0 +1,77 @@
+#include "cpu.hpp"
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace {
+
+void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4]) {
+#if defined(_MSC_VER)
+    __cpuidex((int*)regs, int(leaf), int(subleaf));
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+uint64_t xgetbv0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (uint64_t(hi) << 32) | lo;
+#endif
+}
+
+bool bit(uint32_t x, int i) {
+    return (x >> i) & 1;
+}
+
+CPUFeatures detect() {
+    CPUFeatures f{};
+    uint32_t r[4];
+
+    cpuid(0, 0, r);
+    const uint32_t max_leaf = r[0];
+    if (max_leaf < 1)
+        return f;
+
+    cpuid(1, 0, r);
+    f.ssse3 = bit(r[2], 9);
+    f.sse41 = bit(r[2], 19);
+    f.popcnt = bit(r[2], 23);
+    const bool osxsave = bit(r[2], 27), avx = bit(r[2], 28);
+
+    // XMM and YMM state, then opmask and both halves of ZMM state
+    const uint64_t xcr0 = osxsave ? xgetbv0() : 0;
+    const bool os_avx = avx && (xcr0 & 0x06) == 0x06;
+    const bool os_avx512 = os_avx && (xcr0 & 0xE0) == 0xE0;
+
+    if (max_leaf < 7)
+        return f;
+
+    cpuid(7, 0, r);
+    f.bmi2 = bit(r[1], 8);
+    f.avx2 = os_avx && bit(r[1], 5);
+    f.avx512f = os_avx512 && bit(r[1], 16);
+    f.avx512bw = os_avx512 && bit(r[1], 30);
+    f.avx512vl = os_avx512 && bit(r[1], 31);
+    f.avx512vnni = os_avx512 && bit(r[2], 11);
+
+    cpuid(7, 1, r);
+    f.avxvnni = os_avx && bit(r[0], 4);
+
+    return f;
+}
+
+} // namespace
+
+const CPUFeatures& cpu_features() {
+    static const CPUFeatures features = detect();
+    return features;
+}
@@ -0,0 +1,14 @@
+#ifndef PRIMITIVE_CPU_HPP
+#define PRIMITIVE_CPU_HPP
+
+// Instruction sets the CPU and the OS both support, queried once through cpuid.
+// AVX and AVX-512 also need the OS to save their registers, which xgetbv tells.
+struct CPUFeatures {
+    bool popcnt, ssse3, sse41;
+    bool avx2, bmi2, avxvnni;
+    bool avx512f, avx512bw, avx512vl, avx512vnni;
+};
+
+const CPUFeatures& cpu_features();
+
+#endif
@@ -0,0 +1,79 @@
+#include "perf.hpp"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+
+namespace {
+
+int open_counter(uint64_t config, int group_fd) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = group_fd < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return int(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+}
+
+uint64_t read_counter(int fd) {
+    uint64_t x = 0;
+    return read(fd, &x, sizeof(x)) == sizeof(x) ? x : 0;
+}
+
+} // namespace
+
+// the misses are in the group of the cycles, so both count over the same time
+PerfCounters::PerfCounters() {
+    fd_cycles_ = open_counter(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (fd_cycles_ >= 0)
+        fd_misses_ = open_counter(PERF_COUNT_HW_CACHE_MISSES, fd_cycles_);
+
+    if (fd_misses_ < 0 && fd_cycles_ >= 0) {
+        close(fd_cycles_);
+        fd_cycles_ = -1;
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    if (fd_misses_ >= 0) close(fd_misses_);
+    if (fd_cycles_ >= 0) close(fd_cycles_);
+}
+
+bool PerfCounters::available() const {
+    return fd_cycles_ >= 0;
+}
+
+void PerfCounters::start() {
+    if (!available())
+        return;
+    ioctl(fd_cycles_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(fd_cycles_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+PerfCounters::Counts PerfCounters::stop() {
+    Counts c;
+    if (!available())
+        return c;
+
+    ioctl(fd_cycles_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    c.cycles = read_counter(fd_cycles_);
+    c.cache_misses = read_counter(fd_misses_);
+    return c;
+}
+
+#else
+
+PerfCounters::PerfCounters() {}
+PerfCounters::~PerfCounters() {}
+bool PerfCounters::available() const { return false; }
+void PerfCounters::start() {}
+PerfCounters::Counts PerfCounters::stop() { return {}; }
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef PRIMITIVE_PERF_HPP
+#define PRIMITIVE_PERF_HPP
+
+#include <cstdint>
+
+/*
+ * Hardware counters of the calling thread, user space only, through perf_event_open.
+ * They are missing off Linux, without a PMU (most VMs) or when perf_event_paranoid
+ * forbids them, and then every count reads as zero.
+ * */
+class PerfCounters {
+public:
+    struct Counts {
+        uint64_t cycles = 0, cache_misses = 0;
+    };
+
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const;
+
+    void start();
+    // the counts since start
+    Counts stop();
+
+private:
+    int fd_cycles_ = -1, fd_misses_ = -1;
+};
+
+#endif
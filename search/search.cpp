@@ -2,6 +2,7 @@
 #include <cstring>
 #include <cmath>
 #include <iomanip>
+#include <thread>
 
 #include "search.hpp"
 #include "../movepicker.hpp"
@@ -96,6 +97,20 @@ bool can_return_ttscore(const TTEntry &tte,
     return false;
 }
 
+/*
+ * Lazy SMP helpers skip some depths so that they don't all search the same 
+ * iteration at the same time, helper i skips the depths where 
+ * (d + SKIP_PHASE[i]) / SKIP_SIZE[i] is odd.
+ * */
+constexpr int N_SKIP = 20;
+constexpr int SKIP_SIZE[N_SKIP] = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+constexpr int SKIP_PHASE[N_SKIP] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+bool skip_depth(int helper_id, int depth) {
+    int i = (helper_id - 1) % N_SKIP;
+    return (depth + SKIP_PHASE[i]) / SKIP_SIZE[i] % 2 != 0;
+}
+
 Bound determine_bound(int alpha, int beta, int old_alpha) {
     if (alpha >= beta) return BOUND_BETA;
     if (alpha > old_alpha) return BOUND_EXACT;
@@ -193,8 +208,20 @@ void Search::set_silent(bool s) {
     silent_ = s;
 }
 
+void Search::set_helpers(std::vector<Search*> helpers) {
+    helpers_ = std::move(helpers);
+    for (size_t i = 0; i < helpers_.size(); ++i)
+        helpers_[i]->helper_id_ = int(i + 1);
+}
+
 void Search::new_game() {
     g_tt.new_search();
+    clear_histories();
+    for (Search *h: helpers_)
+        h->clear_histories();
+}
+
+void Search::clear_histories() {
     hist_.reset();
     memset(counters_.data(), 0, sizeof(counters_));
     memset(followups_.data(), 0, sizeof(followups_));
@@ -218,23 +245,33 @@ void Search::setup(const Board &root,  const SearchLimits &limits,
 
     root_.set_stateinfo(&root_si_);
     root_si_.previous = nullptr;
+    acc_cache_.n_full = acc_cache_.n_cached = 0;
     mini::refresh_accumulator(root_, root_si_.acc, WHITE);
     mini::refresh_accumulator(root_, root_si_.acc, BLACK);
 
     man_.init(limits, root.side_to_move());
 
     keep_going_ = true;
+    searching_ = true;
+
+    // helpers don't need multipv, they only have to fill the TT
+    for (Search *h: helpers_)
+        h->setup(root, limits, st, ponder, 1);
 }
 
 bool Search::keep_going() {
-    if (stats_.nodes % 2048 == 0 && keep_going_) {
+    // helpers are stopped by the main search
+    if (helper_id_)
+        return keep_going_;
+
+    if (stats_.nodes.load(std::memory_order_relaxed) % 2048 == 0 && keep_going_) {
         switch (limits_.type) {
         case SearchLimits::UNLIMITED: 
         case SearchLimits::DEPTH:
             break;
 
         case SearchLimits::NODES:
-            keep_going_ = stats_.nodes < limits_.nodes;
+            keep_going_ = total_nodes() < limits_.nodes;
             break;
         case SearchLimits::TIME:
             keep_going_ = !man_.out_of_time();
@@ -254,8 +291,10 @@ void Search::iterative_deepening() {
     }
 
     if (rmp_.num_moves() == 1 && !silent_ && !pondering_) {
+        stop_helpers();
         RootMove m = rmp_.best_move();
         sync_cout() << "bestmove " << m.move << '\n';
+        searching_.store(false, std::memory_order_release);
         return;
     }
 
@@ -271,6 +310,9 @@ void Search::iterative_deepening() {
 
     const int max_depth = limits_.type == limits_.DEPTH ? limits_.depth : MAX_DEPTH;
     for (int d = 2; d <= max_depth; ++d) {
+        if (helper_id_ && skip_depth(helper_id_, d))
+            continue;
+
         stats_.id_depth = d;
         prev_score = score;
         TimePoint start = timer::now();
@@ -308,9 +350,13 @@ void Search::iterative_deepening() {
 
     while (pondering_);
 
+    stop_helpers();
+    wait_for_helpers();
+
     RootMove rm = rmp_.best_move();
     if (!silent_) {
         auto out = sync_cout();
+        out << "info string " << total_tt_stats() << '\n';
         out << "bestmove " << rm.move;
 
         TTEntry tte;
@@ -319,15 +365,32 @@ void Search::iterative_deepening() {
             out << " ponder " << Move(tte.move16);
         out << '\n';
     }
+
+    searching_.store(false, std::memory_order_release);
 }
 
 void Search::atomic_stop() {
     keep_going_ = false;
     pondering_ = false;
+    stop_helpers();
 }
 
 void Search::stop_pondering() {
     pondering_ = false;
+    for (Search *h: helpers_)
+        h->stop_pondering();
+}
+
+void Search::stop_helpers() {
+    for (Search *h: helpers_)
+        h->atomic_stop();
+}
+
+void Search::wait_for_helpers() {
+    // they stop within a node once stopped, then their stats are theirs no more
+    for (const Search *h: helpers_)
+        while (h->searching_.load(std::memory_order_acquire))
+            std::this_thread::yield();
 }
 
 RootMove Search::get_pv_start(int i) const { 
@@ -339,6 +402,32 @@ int Search::num_pvs() const { return n_pvs_; }
 
 const SearchStats& Search::get_stats() const { return stats_; }
 
+void Search::set_acc_cache(bool enabled) { acc_cache_.enabled = enabled; }
+
+const mini::AccumulatorCache& Search::acc_cache() const { return acc_cache_; }
+
+// only once the helpers are done, see wait_for_helpers
+TTStats Search::total_tt_stats() const {
+    TTStats tt = stats_.tt;
+    for (const Search *h: helpers_)
+        tt += h->stats_.tt;
+    return tt;
+}
+
+uint64_t Search::total_nodes() const {
+    // The helpers are still running, their counts are atomic but may be a little behind
+    uint64_t nodes = stats_.nodes.load(std::memory_order_relaxed);
+    for (const Search *h: helpers_)
+        nodes += h->stats_.nodes.load(std::memory_order_relaxed);
+    return nodes;
+}
+
+void Search::count_node() {
+    // only this thread writes the count, so no locked add
+    stats_.nodes.store(stats_.nodes.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+}
+
 int Search::aspiration_window(int score, int depth) {
     if (depth < params::asp_min_depth)
         return search<true>(root_, -VALUE_MATE, VALUE_MATE, depth);
@@ -402,7 +491,7 @@ int Search::search(const Board &b, int alpha,
         return b.checkers() ? quiescence<true>(b, alpha, beta)
             : quiescence<false>(b, alpha, beta);
 
-    stats_.nodes++;
+    count_node();
     stats_.sel_depth = std::max(stats_.sel_depth, ply);
 
     auto &entry = stack_.at(ply);
@@ -412,13 +501,16 @@ int Search::search(const Board &b, int alpha,
     bool avoid_null = false;
     Move ttm = MOVE_NONE;
     int16_t eval;
+    stats_.tt.probes++;
     if (g_tt.probe(b.key(), tte)) {
+        stats_.tt.hits++;
         if (ttm = Move(tte.move16); !b.is_valid_move(ttm))
             ttm = MOVE_NONE;
         
         // TODO: consider not returning when in PV node
         if (!is_root && !excluded && can_return_ttscore(tte, alpha, beta, depth, ply) && !is_pv) 
         {
+            stats_.tt.cutoffs++;
             if (ttm && b.is_quiet(ttm))
                 hist_.add_bonus(b, ttm, depth * depth);
             return alpha;
@@ -632,9 +724,9 @@ move_loop:
 
     if (!excluded) {
         if (!is_root || (is_root && amp.num_excluded_moves() == 0)) {
-            g_tt.store(b.key(), alpha, eval,
+            stats_.tt.record(g_tt.store(b.key(), alpha, eval,
                 determine_bound(alpha, beta, old_alpha),
-                depth, best_move, ply, avoid_null);
+                depth, best_move, ply, avoid_null));
         }
 
         amp.complete_iter(best_move_idx);
@@ -650,7 +742,7 @@ int Search::quiescence(const Board &b,
     if (!keep_going() || is_board_drawn(b))
         return 0;
 
-    stats_.nodes++;
+    count_node();
     stats_.qnodes++;
 
     //Mate distance pruning
@@ -711,7 +803,7 @@ bool Search::is_board_drawn(const Board &b) const {
 int16_t Search::evaluate(const Board &b) {
     int16_t result;
     if (!ev_cache_.probe(b.key(), result)) {
-        result = static_cast<int16_t>(mini::evaluate(b));
+        result = static_cast<int16_t>(mini::evaluate(b, &acc_cache_));
         ev_cache_.store(b.key(), result);
     }
 
@@ -731,7 +823,8 @@ void Search::uci_report() const {
         return;
 
     long long elapsed = timer::now() - limits_.start;
-    unsigned long long nps = stats_.nodes * 1000 / (elapsed + 1);
+    unsigned long long nodes = total_nodes();
+    unsigned long long nps = nodes * 1000 / (elapsed + 1);
     float fhf = stats_.fail_high_first / (stats_.fail_high + 1.f);
 
     auto out = sync_cout();
@@ -743,7 +836,7 @@ void Search::uci_report() const {
             << " score " << Score { rm.score }
             << " depth " << stats_.id_depth
             << " seldepth " << stats_.sel_depth
-            << " nodes " << stats_.nodes
+            << " nodes " << nodes
             << " time " << elapsed
             << " nps " << nps
             << " fhf " << std::setprecision(4) << fhf
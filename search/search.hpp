@@ -8,8 +8,10 @@
 #include "search_common.hpp"
 #include "../movepicker.hpp"
 #include "../evalcache.hpp"
+#include "../mininnue/nnue.hpp"
 
 #include <atomic>
+#include <vector>
 
 
 struct RootMove {
@@ -50,6 +52,11 @@ public:
 
     void set_silent(bool s);
 
+    // Lazy SMP: helpers are set up, stopped and cleared together with this search,
+    // their node counts are included into the report and the node limit.
+    // Only this search prints bestmove and checks the limits.
+    void set_helpers(std::vector<Search*> helpers);
+
     void new_game();
 
     void setup(const Board &root, const SearchLimits &limits,
@@ -64,9 +71,20 @@ public:
     int num_pvs() const;
 
     const SearchStats& get_stats() const;
+    uint64_t total_nodes() const;
+    TTStats total_tt_stats() const;
+
+    // accumulator refreshes go through the cache unless it's turned off, for comparison
+    void set_acc_cache(bool enabled);
+    const mini::AccumulatorCache& acc_cache() const;
 
 private:
+    void clear_histories();
+    void stop_helpers();
+    void wait_for_helpers();
+
     bool keep_going();
+    void count_node();
     int aspiration_window(int score, int depth);
 
     template<bool is_root = false>
@@ -99,8 +117,15 @@ private:
     SearchStats stats_;
 
     EvalCache ev_cache_;
+    mini::AccumulatorCache acc_cache_;
     bool silent_ = false;
+    std::vector<Search*> helpers_;
+    // 0 for the main search, helpers are numbered from 1
+    int helper_id_ = 0;
+
     std::atomic_bool keep_going_;
+    // cleared when iterative_deepening returns
+    std::atomic_bool searching_ = false;
     std::atomic_bool pondering_ = false;
 };
 
@@ -3,19 +3,26 @@
 
 #include <cstdint>
 #include <chrono>
+#include <atomic>
 #include "../primitives/common.hpp"
 #include "../parameters.hpp"
+#include "../tt.hpp"
 
 struct SearchStats {
-    uint64_t nodes{}, qnodes{};
+    // the other threads read it while the search runs, see Search::total_nodes
+    std::atomic<uint64_t> nodes{};
+    uint64_t qnodes{};
     uint64_t fail_high{}, fail_high_first{};
     int sel_depth{};
     // keep track of iteradtive deepening depth
     int id_depth{};
 
+    TTStats tt;
+
     void reset() {
         nodes = qnodes = fail_high = fail_high_first = 0;
         sel_depth = id_depth = 0;
+        tt = TTStats();
     }
 };
 
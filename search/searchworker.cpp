@@ -1,45 +1,50 @@
 #include "searchworker.hpp"
+#include <algorithm>
 
-SearchWorker::SearchWorker() 
-    : search_(new Search)
-{
-    terminate_.store(false, std::memory_order_relaxed);
-    go_.store(false, std::memory_order_relaxed);
-    done_.store(true, std::memory_order_relaxed);
+SearchWorker::SearchWorker() {
+    searches_.emplace_back(new Search);
+    start_threads();
+}
 
-    thread_ = std::thread([this] {
-        while (true) {
-            {
-                std::unique_lock<std::mutex> lock(mutex_);
-                go_cv_.wait(lock, [this] { return go_ || terminate_; });
-            }
+SearchWorker::~SearchWorker() {
+    stop();
+    wait_for_completion();
+    join_threads();
+}
 
-            if (terminate_) break;
+void SearchWorker::set_silent(bool s) {
+    silent_ = s;
+    searches_[0]->set_silent(s);
+}
 
-            search_->iterative_deepening();
+void SearchWorker::set_threads(int n) {
+    stop();
+    wait_for_completion();
+    join_threads();
 
-            go_ = false;
-            done_ = true;
-            done_cv_.notify_all();
-        }
-    });
-}
+    searches_.resize(std::max(1, n));
+    for (auto &s: searches_)
+        if (!s)
+            s.reset(new Search);
 
-SearchWorker::~SearchWorker() {
-    search_->atomic_stop();
-    terminate_ = true;
-    go_cv_.notify_one();
+    std::vector<Search*> helpers;
+    for (size_t i = 1; i < searches_.size(); ++i) {
+        searches_[i]->set_silent(true);
+        helpers.push_back(searches_[i].get());
+    }
 
-    wait_for_completion();
-    thread_.join();
+    searches_[0]->set_silent(silent_);
+    searches_[0]->set_helpers(std::move(helpers));
+
+    start_threads();
 }
 
-void SearchWorker::set_silent(bool s) {
-    search_->set_silent(s);
+int SearchWorker::num_threads() const {
+    return int(searches_.size());
 }
 
 void SearchWorker::new_game() {
-    search_->new_game();
+    searches_[0]->new_game();
 }
 
 void SearchWorker::go(const Board &root, const SearchLimits &limits, 
@@ -48,25 +53,70 @@ void SearchWorker::go(const Board &root, const SearchLimits &limits,
     stop();
     wait_for_completion();
 
-    search_->setup(root, limits, st, ponder, multipv);
+    // sets up the helpers as well
+    searches_[0]->setup(root, limits, st, ponder, multipv);
 
-    done_ = false;
-    go_ = true;
-    go_cv_.notify_one();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        n_running_ = int(searches_.size());
+        ++generation_;
+    }
+    go_cv_.notify_all();
 }
 
 void SearchWorker::stop() {
-    search_->atomic_stop();
-    go_ = false;
+    // stops the helpers as well
+    searches_[0]->atomic_stop();
 }
 
 void SearchWorker::stop_pondering() {
-    search_->stop_pondering();
+    searches_[0]->stop_pondering();
 }
 
 void SearchWorker::wait_for_completion() {
     std::unique_lock<std::mutex> lock(mutex_);
-    done_cv_.wait(lock, [this] { return done_.load(std::memory_order_relaxed); });
+    done_cv_.wait(lock, [this] { return n_running_ == 0; });
+}
+
+const Search& SearchWorker::main_search() const {
+    return *searches_[0];
+}
+
+void SearchWorker::start_threads() {
+    for (int i = 0; i < num_threads(); ++i)
+        threads_.emplace_back([this, i, gen = generation_] { thread_routine(i, gen); });
 }
 
+void SearchWorker::join_threads() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        terminate_ = true;
+    }
+    go_cv_.notify_all();
+
+    for (auto &t: threads_)
+        t.join();
+    threads_.clear();
+
+    terminate_ = false;
+}
 
+void SearchWorker::thread_routine(int idx, uint64_t generation) {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            go_cv_.wait(lock, [&] { return generation_ != generation || terminate_; });
+
+            if (terminate_) break;
+            generation = generation_;
+        }
+
+        searches_[idx]->iterative_deepening();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --n_running_;
+        }
+        done_cv_.notify_all();
+    }
+}
@@ -2,6 +2,7 @@
 #define SEARCHWORKER_HPP
 
 #include <memory>
+#include <vector>
 #include "search.hpp"
 
 #include <mutex>
@@ -16,6 +17,10 @@ public:
 
     void set_silent(bool s);
 
+    // Lazy SMP: the first search is the main one, the rest are its helpers
+    void set_threads(int n);
+    int num_threads() const;
+
     void new_game();
 
     void go(const Board &root, const SearchLimits &limits, 
@@ -25,15 +30,25 @@ public:
     void stop_pondering();
     void wait_for_completion();
 
+    const Search& main_search() const;
+
 private:
-    std::unique_ptr<Search> search_;
+    void start_threads();
+    void join_threads();
+    void thread_routine(int idx, uint64_t generation);
+
+    std::vector<std::unique_ptr<Search>> searches_;
+    std::vector<std::thread> threads_;
 
-    std::thread thread_;
     std::mutex mutex_;
     std::condition_variable go_cv_, done_cv_;
 
-    std::atomic_bool go_, done_;
-    std::atomic_bool terminate_;
+    // guarded by mutex_
+    uint64_t generation_ = 0;
+    int n_running_ = 0;
+    bool terminate_ = false;
+
+    bool silent_ = false;
 };
 
 #endif
@@ -1,16 +1,48 @@
 #include "tt.hpp"
 #include <cstring>
+#include <cstdio>
 #include "board/board.hpp"
 #include "parameters.hpp"
+#include "scout.hpp"
 #include <xmmintrin.h>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <ostream>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
-TranspositionTable g_tt;
+TT g_tt;
 
 
-TranspositionTable::TranspositionTable() {
+template<typename Bucket>
+TranspositionTable<Bucket>::TranspositionTable() {
     resize(params::defaults::tt_size);
 }
 
+std::ostream& operator<<(std::ostream &os, const TTStats &st) {
+    const auto pct = [](uint64_t x, uint64_t total) {
+        return total ? 100 * x / total : 0;
+    };
+
+    return os << "tt probes " << st.probes
+        << " hits " << st.hits << " (" << pct(st.hits, st.probes) << "%)"
+        << " cutoffs " << st.cutoffs << " (" << pct(st.cutoffs, st.hits) << "%)"
+        << " stores " << st.stores
+        << " empty " << st.writes[int(TTWrite::EMPTY)]
+        << " samekey " << st.writes[int(TTWrite::SAME_KEY)]
+        << " aged " << st.writes[int(TTWrite::AGED)]
+        << " depth " << st.writes[int(TTWrite::DEPTH)]
+        << " always " << st.writes[int(TTWrite::ALWAYS)];
+}
+
 int TTEntry::score(int ply) const {
     int s = score16;
     if (s > MATE_BOUND)
@@ -42,99 +74,455 @@ TTEntry::TTEntry(uint16_t key16, int s, int e, Bound b,
     this->age = age;
 }
 
-void TranspositionTable::resize(size_t mbs) {
-    if (buckets_)
-        delete[] buckets_;
-    size_ = mbs * 1024 * 1024 / sizeof(Bucket);
-    buckets_ = new Bucket[size_];
-    memset(buckets_, 0, size_ * sizeof(Bucket));
+static_assert(sizeof(TTEntry) == 10 && offsetof(TTEntry, move16) == 2);
+
+uint64_t TTEntry::data() const {
+    uint64_t d;
+    memcpy(&d, &move16, sizeof(d));
+    return d;
 }
 
-void TranspositionTable::clear() {
-    if (buckets_)
-        memset(buckets_, 0, size_ * sizeof(Bucket));
+TTEntry TTEntry::from_data(uint16_t key16, uint64_t data) {
+    TTEntry e;
+    e.key16 = key16;
+    memcpy(&e.move16, &data, sizeof(data));
+    return e;
 }
 
-void TranspositionTable::new_search() {
-    ++age_;
+static uint16_t fold16(uint64_t x) {
+    return uint16_t(x ^ (x >> 16) ^ (x >> 32) ^ (x >> 48));
 }
 
-bool TranspositionTable::probe(uint64_t key, TTEntry &e) const {
-    uint64_t key16 = uint16_t(key);
+static uint32_t fold32(uint64_t x) {
+    return uint32_t(x ^ (x >> 32));
+}
+
+TTEntry CompactBucket::load(int i) const {
+    uint64_t d = data[i].load(std::memory_order_relaxed);
+    uint16_t k = keys[i].load(std::memory_order_relaxed);
+    return TTEntry::from_data(k ^ fold16(d), d);
+}
 
-    Bucket &b = buckets_[bucket_by_key(key)];
-    for (int i = 0; i < Bucket::N; ++i) {
-        e = b.entries[i];
-        if (e.key16 == key16) {
-            e.age = age_;
+bool CompactBucket::probe(uint64_t key, TTEntry &e) const {
+    uint16_t key16 = uint16_t(key);
+    for (int i = 0; i < N; ++i) {
+        e = load(i);
+        if (e.key16 == key16)
             return true;
-        }
     }
 
     return false;
 }
 
-void TranspositionTable::store(uint64_t key, int score, int eval, 
-        Bound bnd, int depth, Move m, int ply, bool avoid_null)
-{
+TTWrite CompactBucket::store(uint64_t key, const TTEntry &new_entry, uint8_t age) {
     uint16_t key16 = uint16_t(key);
-    Bucket &b = buckets_[bucket_by_key(key)];
 
-    TTEntry *replace = nullptr;
-    for (int i = 0; i < Bucket::N; ++i) {
-        TTEntry &e = b.entries[i];
-        if (e.key16 == key16) {
-            replace = &e;
+    TTEntry entries[N];
+    for (int i = 0; i < N; ++i)
+        entries[i] = load(i);
+
+    int replace = -1;
+    TTWrite kind = TTWrite::SAME_KEY;
+    for (int i = 0; i < N; ++i) {
+        if (entries[i].key16 == key16) {
+            replace = i;
             break;
         }
     }
 
-    if (!replace) {
+    if (replace < 0) {
+        kind = TTWrite::AGED;
         int replace_depth = 9999;
-        for (int i = 0; i < Bucket::N; ++i) {
-            TTEntry &e = b.entries[i];
-            if (e.age != age_ && e.depth5 < replace_depth) {
-                replace = &e;
+        for (int i = 0; i < N; ++i) {
+            const TTEntry &e = entries[i];
+            if (e.age != age && e.depth5 < replace_depth) {
+                replace = i;
                 replace_depth = e.depth5;
             }
         }
 
-        if (!replace) {
-            for (int i = 0; i < Bucket::N; ++i) {
-                TTEntry &e = b.entries[i];
+        if (replace < 0) {
+            kind = TTWrite::DEPTH;
+            for (int i = 0; i < N; ++i) {
+                const TTEntry &e = entries[i];
                 if (e.depth5 < replace_depth) {
-                    replace = &e;
+                    replace = i;
                     replace_depth = e.depth5;
                 }
             }
         }
     }
 
-    *replace = TTEntry(key16, score, eval, bnd, depth, m, ply, avoid_null, age_);
+    if (kind != TTWrite::SAME_KEY && !entries[replace].data())
+        kind = TTWrite::EMPTY;
+
+    uint64_t d = new_entry.data();
+    data[replace].store(d, std::memory_order_relaxed);
+    keys[replace].store(key16 ^ fold16(d), std::memory_order_relaxed);
+
+    return kind;
+}
+
+// TTEntry has room for only 16 bits of the key, so the full 32 bits are compared here
+TTEntry WideBucket::load(int i) const {
+    uint64_t d = data[i].load(std::memory_order_relaxed);
+    uint32_t k = keys[i].load(std::memory_order_relaxed);
+    return TTEntry::from_data(uint16_t(k ^ fold32(d)), d);
 }
 
-void TranspositionTable::prefetch(uint64_t key) const {
-    _mm_prefetch((const char*)&buckets_[key % size_], 
+bool WideBucket::probe(uint64_t key, TTEntry &e) const {
+    uint32_t key32 = uint32_t(key);
+    for (int i = 0; i < N; ++i) {
+        uint64_t d = data[i].load(std::memory_order_relaxed);
+        if ((keys[i].load(std::memory_order_relaxed) ^ fold32(d)) == key32) {
+            e = TTEntry::from_data(uint16_t(key32), d);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+TTWrite WideBucket::store(uint64_t key, const TTEntry &new_entry, uint8_t age) {
+    uint32_t key32 = uint32_t(key);
+
+    TTEntry entries[N];
+    int replace = -1;
+    for (int i = 0; i < N; ++i) {
+        uint64_t d = data[i].load(std::memory_order_relaxed);
+        if ((keys[i].load(std::memory_order_relaxed) ^ fold32(d)) == key32)
+            replace = i;
+        entries[i] = TTEntry::from_data(0, d);
+    }
+
+    TTWrite kind = TTWrite::SAME_KEY;
+    if (replace < 0) {
+        // the depth-preferred victim: entries of older searches first, then the shallowest
+        replace = 0;
+        for (int i = 1; i < N_DEPTH; ++i) {
+            const TTEntry &e = entries[i], &r = entries[replace];
+            bool e_aged = e.age != age, r_aged = r.age != age;
+            if (e_aged != r_aged ? e_aged : e.depth5 < r.depth5)
+                replace = i;
+        }
+
+        if (entries[replace].age != age) {
+            kind = TTWrite::AGED;
+        } else if (new_entry.depth5 >= entries[replace].depth5) {
+            kind = TTWrite::DEPTH;
+        } else {
+            kind = TTWrite::ALWAYS;
+            replace = N - 1;
+        }
+
+        if (!entries[replace].data())
+            kind = TTWrite::EMPTY;
+    }
+
+    uint64_t d = new_entry.data();
+    data[replace].store(d, std::memory_order_relaxed);
+    keys[replace].store(key32 ^ fold32(d), std::memory_order_relaxed);
+
+    return kind;
+}
+
+static_assert(sizeof(CompactBucket) == 32 && sizeof(WideBucket) == 64);
+static_assert(sizeof(std::atomic<uint64_t>) == 8 && sizeof(std::atomic<uint16_t>) == 2);
+
+namespace {
+
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+#if defined(__linux__)
+// The AnonHugePages of the mappings in [begin, end), each capped by its overlap with the range
+size_t anon_huge_bytes(uintptr_t begin, uintptr_t end) {
+    std::ifstream fin("/proc/self/smaps");
+    std::string line;
+    size_t total = 0, overlap = 0;
+    while (std::getline(fin, line)) {
+        unsigned long long lo, hi, kb;
+        char dash;
+        if (sscanf(line.c_str(), "%llx%c%llx", &lo, &dash, &hi) == 3 && dash == '-') {
+            overlap = lo < end && hi > begin ? std::min<uintptr_t>(hi, end) - std::max<uintptr_t>(lo, begin) : 0;
+        } else if (overlap && sscanf(line.c_str(), "AnonHugePages: %llu kB", &kb) == 1) {
+            total += std::min<size_t>(kb * 1024, overlap);
+        }
+    }
+    return total;
+}
+#endif
+
+// Zeroes the memory from several threads. The OS places a page on the NUMA node 
+// of the thread that touches it first, so the table gets spread over all nodes.
+void parallel_zero(void *mem, size_t size, int max_threads) {
+    constexpr size_t MIN_CHUNK = 16 * 1024 * 1024;
+
+    size_t n_threads = std::clamp<size_t>(size / MIN_CHUNK, 1, std::max(1, max_threads));
+
+    size_t chunk = (size / n_threads + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n_threads; ++i) {
+        size_t start = std::min(size, i * chunk), end = std::min(size, start + chunk);
+        threads.emplace_back([=] { memset((char*)mem + start, 0, end - start); });
+    }
+
+    memset(mem, 0, std::min(size, chunk));
+
+    for (auto &t: threads)
+        t.join();
+}
+
+} // namespace
+
+template<typename Bucket>
+void TranspositionTable<Bucket>::allocate(size_t bytes) {
+    // round up to whole huge pages so that the tail is backed by one as well
+    alloc_size_ = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    mmapped_ = hugetlb_ = false;
+
+    void *mem = nullptr;
+
+#if defined(__linux__)
+    // explicit hugetlb pages, available only if reserved through vm.nr_hugepages.
+    // 2 MB ones whatever the default huge page size, the rounding above assumes it.
+    int huge_2mb = 0;
+#if defined(MAP_HUGE_2MB)
+    huge_2mb = MAP_HUGE_2MB;
+#elif defined(MAP_HUGE_SHIFT)
+    huge_2mb = 21 << MAP_HUGE_SHIFT;
+#endif
+    mem = mmap(nullptr, alloc_size_, PROT_READ | PROT_WRITE, 
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge_2mb, -1, 0);
+    if (mem != MAP_FAILED) {
+        mmapped_ = hugetlb_ = true;
+    } else {
+        // transparent huge pages, if the kernel gets around to it
+        mem = std::aligned_alloc(HUGE_PAGE_SIZE, alloc_size_);
+        if (mem)
+            madvise(mem, alloc_size_, MADV_HUGEPAGE);
+    }
+#elif defined(_MSC_VER)
+    mem = _aligned_malloc(alloc_size_, HUGE_PAGE_SIZE);
+#else
+    mem = std::aligned_alloc(HUGE_PAGE_SIZE, alloc_size_);
+#endif
+
+    if (!mem) {
+        sync_cout() << "info string Failed to allocate " << alloc_size_ 
+            << " bytes for the hash table\n";
+        std::abort();
+    }
+
+    buckets_ = static_cast<Bucket*>(mem);
+}
+
+template<typename Bucket>
+void TranspositionTable<Bucket>::deallocate() {
+    if (!buckets_)
+        return;
+
+#if defined(__linux__)
+    if (mmapped_)
+        munmap(buckets_, alloc_size_);
+    else
+        std::free(buckets_);
+#elif defined(_MSC_VER)
+    _aligned_free(buckets_);
+#else
+    std::free(buckets_);
+#endif
+
+    buckets_ = nullptr;
+}
+
+template<typename Bucket>
+void TranspositionTable<Bucket>::resize(size_t mbs) {
+    deallocate();
+    size_ = mbs * 1024 * 1024 / sizeof(Bucket);
+    allocate(size_ * sizeof(Bucket));
+    parallel_zero(buckets_, size_ * sizeof(Bucket), n_threads_);
+}
+
+template<typename Bucket>
+size_t TranspositionTable<Bucket>::huge_page_bytes() const {
+    if (hugetlb_)
+        return alloc_size_;
+#if defined(__linux__)
+    if (buckets_)
+        return anon_huge_bytes(uintptr_t(buckets_), uintptr_t(buckets_) + alloc_size_);
+#endif
+    return 0;
+}
+
+namespace {
+
+struct TTFileHeader {
+    static constexpr char MAGIC[8] = { 'S', 'A', 'T', 'U', 'R', 'N', 'T', 'T' };
+    static constexpr uint32_t VERSION = 1;
+    // the buckets start at this offset, which keeps them page aligned for mmap
+    static constexpr size_t SIZE = 4096;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t bucket_size;
+    uint64_t n_buckets;
+    uint8_t age;
+};
+
+} // namespace
+
+template<typename Bucket>
+bool TranspositionTable<Bucket>::save(const char *path) const {
+    std::ofstream fout(path, std::ios::binary);
+    if (!fout)
+        return false;
+
+    char buf[TTFileHeader::SIZE]{};
+    TTFileHeader header{};
+    memcpy(header.magic, TTFileHeader::MAGIC, sizeof(header.magic));
+    header.version = TTFileHeader::VERSION;
+    header.bucket_size = sizeof(Bucket);
+    header.n_buckets = size_;
+    header.age = age_;
+    memcpy(buf, &header, sizeof(header));
+
+    return fout.write(buf, sizeof(buf)) 
+        && fout.write((const char*)buckets_, size_ * sizeof(Bucket));
+}
+
+template<typename Bucket>
+bool TranspositionTable<Bucket>::load(const char *path) {
+    std::ifstream fin(path, std::ios::binary | std::ios::ate);
+    if (!fin)
+        return false;
+    
+    const uint64_t file_size = fin.tellg();
+    fin.seekg(0);
+
+    TTFileHeader header;
+    if (!fin.read((char*)&header, sizeof(header)))
+        return false;
+
+    if (memcmp(header.magic, TTFileHeader::MAGIC, sizeof(header.magic))
+            || header.version != TTFileHeader::VERSION
+            || header.bucket_size != sizeof(Bucket)
+            || !header.n_buckets
+            || header.n_buckets > (SIZE_MAX - TTFileHeader::SIZE) / sizeof(Bucket)
+            || file_size != TTFileHeader::SIZE + header.n_buckets * sizeof(Bucket))
+        return false;
+
+    const size_t bytes = header.n_buckets * sizeof(Bucket);
+
+#if defined(__linux__)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    // private mapping: the search writes into the pages without touching the file
+    void *mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, 
+            MAP_PRIVATE, fd, TTFileHeader::SIZE);
+    close(fd);
+    if (mem == MAP_FAILED)
+        return false;
+
+    deallocate();
+    buckets_ = static_cast<Bucket*>(mem);
+    alloc_size_ = bytes;
+    mmapped_ = true;
+    hugetlb_ = false;
+#else
+    // read into a new table, the current one stays until the whole file is in
+    Bucket *old = buckets_;
+    size_t old_alloc_size = alloc_size_;
+    buckets_ = nullptr;
+    allocate(bytes);
+
+    fin.seekg(TTFileHeader::SIZE);
+    const bool ok = bool(fin.read((char*)buckets_, bytes));
+    if (!ok) {
+        std::swap(buckets_, old);
+        std::swap(alloc_size_, old_alloc_size);
+    }
+
+    // frees the one not kept
+    Bucket *kept = buckets_;
+    size_t kept_alloc_size = alloc_size_;
+    buckets_ = old;
+    alloc_size_ = old_alloc_size;
+    deallocate();
+    buckets_ = kept;
+    alloc_size_ = kept_alloc_size;
+
+    if (!ok)
+        return false;
+#endif
+
+    size_ = header.n_buckets;
+    age_ = header.age;
+
+    return true;
+}
+
+template<typename Bucket>
+void TranspositionTable<Bucket>::clear() {
+    if (buckets_)
+        parallel_zero(buckets_, size_ * sizeof(Bucket), n_threads_);
+}
+
+template<typename Bucket>
+void TranspositionTable<Bucket>::set_threads(int n) {
+    n_threads_ = std::max(1, n);
+}
+
+template<typename Bucket>
+void TranspositionTable<Bucket>::new_search() {
+    ++age_;
+}
+
+template<typename Bucket>
+bool TranspositionTable<Bucket>::probe(uint64_t key, TTEntry &e) const {
+    if (!buckets_[bucket_by_key(key)].probe(key, e))
+        return false;
+
+    e.age = age_;
+    return true;
+}
+
+template<typename Bucket>
+TTWrite TranspositionTable<Bucket>::store(uint64_t key, int score, int eval, 
+        Bound bnd, int depth, Move m, int ply, bool avoid_null)
+{
+    return buckets_[bucket_by_key(key)].store(key, 
+            TTEntry(uint16_t(key), score, eval, bnd, depth, m, ply, avoid_null, age_), age_);
+}
+
+template<typename Bucket>
+void TranspositionTable<Bucket>::prefetch(uint64_t key) const {
+    _mm_prefetch((const char*)&buckets_[bucket_by_key(key)], 
             _MM_HINT_NTA);
 }
 
-uint64_t TranspositionTable::hashfull() const {
+template<typename Bucket>
+uint64_t TranspositionTable<Bucket>::hashfull() const {
     uint64_t cnt = 0;
     for (size_t i = 0; i < 1000; ++i) {
-        for (auto &e: buckets_[i].entries)
+        for (int j = 0; j < Bucket::N; ++j) {
+            TTEntry e = buckets_[i].load(j);
             cnt += e.depth5 && e.age == age_;
+        }
     }
 
     return cnt / Bucket::N;
 }
 
-TranspositionTable::~TranspositionTable() {
-    if (buckets_) {
-        delete[] buckets_;
-    }
+template<typename Bucket>
+TranspositionTable<Bucket>::~TranspositionTable() {
+    deallocate();
 }
 
-int TranspositionTable::extract_pv(Board b, Move *pv, int len) {
+template<typename Bucket>
+int TranspositionTable<Bucket>::extract_pv(Board b, Move *pv, int len) {
     int n = 0;
     TTEntry tte;
     StateInfo si;
@@ -149,7 +537,8 @@ int TranspositionTable::extract_pv(Board b, Move *pv, int len) {
     return n;
 }
 
-void TranspositionTable::extract_pv(Board b, PVLine &pv, 
+template<typename Bucket>
+void TranspositionTable<Bucket>::extract_pv(Board b, PVLine &pv, 
         int max_len, Move first_move) 
 {
     TTEntry tte;
@@ -175,8 +564,8 @@ void TranspositionTable::extract_pv(Board b, PVLine &pv,
 }
 
 // Multiply a and b as though they are 128bit and return the high 64 bits
-constexpr inline uint64_t mul_hi64(uint64_t a, uint64_t b) {
-#if defined(__GNUC__) && defined(IS_64BIT)
+static constexpr inline uint64_t mul_hi64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
     __extension__ using uint128 = unsigned __int128;
     return (uint128(a) * uint128(b)) >> 64;
 #else
@@ -189,10 +578,82 @@ constexpr inline uint64_t mul_hi64(uint64_t a, uint64_t b) {
 #endif
 }
 
-uint64_t TranspositionTable::bucket_by_key(uint64_t key) const {
+template<typename Bucket>
+uint64_t TranspositionTable<Bucket>::bucket_by_key(uint64_t key) const {
     // A cool idea from Stockfish to use upper bits of the key as the bucket index.
     // 0 <= key/2^64 < 1, so 0 <= key/2^64 * size_ < size
     return mul_hi64(key, size_);
 }
 
+template class TranspositionTable<CompactBucket>;
+template class TranspositionTable<WideBucket>;
+
+
+
+namespace {
+
+uint64_t splitmix64(uint64_t &state) {
+    uint64_t z = (state += 0x9e37'79b9'7f4a'7c15);
+    z = (z ^ (z >> 30)) * 0xbf58'476d'1ce4'e5b9;
+    z = (z ^ (z >> 27)) * 0x94d0'49bb'1331'11eb;
+    return z ^ (z >> 31);
+}
+
+// The low 16 bits are unique, so a key16 match with the wrong data can only mean corruption.
+// The top 10 bits pick one of ~1000 buckets to make threads fight over the same slots.
+uint64_t stress_key(uint16_t i) {
+    uint64_t state = i;
+    uint64_t hi = splitmix64(state) & 0xFFC0'0000'0000'0000;
+    uint64_t mid = splitmix64(state) & 0x003F'FFFF'FFFF'0000;
+    return hi | mid | i;
+}
+
+TTEntry stress_entry(uint64_t key, uint8_t age) {
+    return TTEntry(uint16_t(key), int16_t(key >> 16) % 2000, int16_t(key >> 32) % 2000,
+            Bound(1 + (key >> 48) % 3), 1 + (key >> 50) % 30, Move(uint16_t(key >> 24)),
+            0, (key >> 60) & 1, age);
+}
 
+} // namespace
+
+uint64_t tt_stress_test(int n_threads, uint64_t n_ops, uint64_t &n_hits) {
+    TT tt;
+    tt.resize(1);
+
+    std::vector<uint64_t> corrupted(n_threads), hits(n_threads);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < n_threads; ++t) {
+        threads.emplace_back([&, t] {
+            uint64_t state = t;
+            TTEntry e;
+            for (uint64_t op = 0; op < n_ops; ++op) {
+                uint64_t r = splitmix64(state);
+                // key16 == 0 would match the empty slots
+                uint64_t key = stress_key(uint16_t(r % 0xFFFF + 1));
+                TTEntry expected = stress_entry(key, 0);
+
+                if (r & (1ull << 32)) {
+                    tt.store(key, expected.score16, expected.eval16, Bound(expected.bound2),
+                            expected.depth5, Move(expected.move16), 0, expected.avoid_null);
+                } else if (tt.probe(key, e)) {
+                    hits[t]++;
+                    e.age = expected.age;
+                    corrupted[t] += e.data() != expected.data();
+                }
+            }
+        });
+    }
+
+    for (auto &th: threads)
+        th.join();
+
+    n_hits = 0;
+    uint64_t n_corrupted = 0;
+    for (int t = 0; t < n_threads; ++t) {
+        n_hits += hits[t];
+        n_corrupted += corrupted[t];
+    }
+
+    return n_corrupted;
+}
@@ -3,6 +3,8 @@
 
 #include "primitives/common.hpp"
 #include <cstddef>
+#include <atomic>
+#include <iosfwd>
 
 class Board;
 
@@ -33,31 +35,45 @@ struct TTEntry {
     TTEntry() = default;
     TTEntry(uint16_t key16, int score, int eval, Bound b, int depth, 
             Move m, int ply, bool avoid_null, uint8_t age);
-};
 
-/* struct TTEntry { */
-/*     uint64_t key; */
-/*     union { */
-/*         uint64_t data; */
-/*         struct { */
-/*             uint16_t move16; */
-/*             int16_t score16; */
-/*             int16_t eval16; */
+    // everything but the key fits into a single 64-bit word
+    uint64_t data() const;
+    static TTEntry from_data(uint16_t key16, uint64_t data);
+};
 
-/*             uint8_t depth5 : 5; */
-/*             uint8_t bound2: 2; */
-/*             uint8_t avoid_null: 1; */
+// What TranspositionTable::store had to overwrite
+enum class TTWrite {
+    EMPTY,      // a slot never used before
+    SAME_KEY,   // the entry of the same position
+    AGED,       // the shallowest entry from an older search
+    DEPTH,      // the shallowest entry of the current search
+    ALWAYS,     // the always-replace slot of a WideBucket
 
-/*             uint8_t age; */
-/*         }; */
-/*     }; */
+    NUM,
+};
 
-/*     int score(int ply) const; */
+// Kept per search thread, so counting doesn't cost any contention
+struct TTStats {
+    uint64_t probes{}, hits{}, cutoffs{}, stores{};
+    uint64_t writes[int(TTWrite::NUM)]{};
+
+    void record(TTWrite w) { 
+        stores++;
+        writes[int(w)]++;
+    }
+
+    TTStats& operator+=(const TTStats &other) {
+        probes += other.probes;
+        hits += other.hits;
+        cutoffs += other.cutoffs;
+        stores += other.stores;
+        for (int i = 0; i < int(TTWrite::NUM); ++i)
+            writes[i] += other.writes[i];
+        return *this;
+    }
+};
 
-/*     TTEntry() = default; */
-/*     TTEntry(uint64_t key, int score, int eval, Bound b, int depth, */ 
-/*             Move m, int ply, bool avoid_null); */
-/* }; */
+std::ostream& operator<<(std::ostream &os, const TTStats &stats);
 
 struct PVLine {
     static constexpr int MAX_LEN = MAX_DEPTH;
@@ -67,24 +83,69 @@ struct PVLine {
     int len=0;
 };
 
-class TranspositionTable {
-    struct Bucket {
-        static constexpr int N = 3;
-        TTEntry entries[N];
+/*
+ * Bucket layouts. Both are lockless: each slot is an atomic data word and 
+ * an atomic key, xor-ed with the folded data. If two threads write the same slot at once,
+ * the key and the data may end up from different stores, 
+ * but then the key check fails and the slot is simply a miss.
+ * */
+
+// 3 entries with 16-bit keys in half a cache line
+struct CompactBucket {
+    static constexpr int N = 3;
+    std::atomic<uint64_t> data[N];
+    std::atomic<uint16_t> keys[N];
+
+    char padding[2];
+
+    TTEntry load(int i) const;
+    bool probe(uint64_t key, TTEntry &e) const;
+    TTWrite store(uint64_t key, const TTEntry &e, uint8_t age);
+};
+
+// A whole cache line: 5 entries with 32-bit keys, so false hits are 65536 times rarer.
+// The first 4 slots keep the deepest entries, the last one takes whatever doesn't fit there.
+struct WideBucket {
+    static constexpr int N = 5;
+    static constexpr int N_DEPTH = 4;
+    std::atomic<uint64_t> data[N];
+    std::atomic<uint32_t> keys[N];
+
+    char padding[4];
 
-        char padding[2];
-    };
+    TTEntry load(int i) const;
+    bool probe(uint64_t key, TTEntry &e) const;
+    TTWrite store(uint64_t key, const TTEntry &e, uint8_t age);
+};
+
+template<typename Bucket>
+class TranspositionTable {
 public:
     TranspositionTable();
 
     void resize(size_t mbs);
     void clear();
 
+    // number of threads that zero the table in resize and clear
+    void set_threads(int n);
+
+    // how much of the table the OS actually backs with 2 MB pages, as of now:
+    // all of it with hugetlb pages, what /proc/self/smaps shows with transparent ones
+    size_t huge_page_bytes() const;
+
+    /*
+     * Dumps the buckets and the age into a file with a page-sized header.
+     * On load the file is memory-mapped copy-on-write where possible,
+     * so even a huge table is usable right away and paged in on demand.
+     * */
+    bool save(const char *path) const;
+    bool load(const char *path);
+
     void new_search();
 
     bool probe(uint64_t key, TTEntry &e) const;
 
-    void store(uint64_t key, int score, int eval, Bound b, int depth, 
+    TTWrite store(uint64_t key, int score, int eval, Bound b, int depth, 
             Move m, int ply, bool avoid_null);
 
     int extract_pv(Board b, Move *pv, int len);
@@ -103,9 +164,26 @@ private:
     size_t size_{};
     uint8_t age_{};
 
+    size_t alloc_size_{};
+    bool mmapped_{}, hugetlb_{};
+    int n_threads_ = 1;
+
+    void allocate(size_t bytes);
+    void deallocate();
+
     uint64_t bucket_by_key(uint64_t key) const;
 };
 
-extern TranspositionTable g_tt;
+#if defined(TT_WIDE_BUCKETS)
+using TT = TranspositionTable<WideBucket>;
+#else
+using TT = TranspositionTable<CompactBucket>;
+#endif
+
+extern TT g_tt;
+
+// Hammers a small table from many threads, every thread storing and probing 
+// the same keys. Returns the number of probe hits with data that doesn't belong to the key.
+uint64_t tt_stress_test(int n_threads, uint64_t n_ops, uint64_t &n_hits);
 
 #endif
@@ -6,6 +6,7 @@
 #include "primitives/utility.hpp"
 #include "tt.hpp"
 #include "mininnue/nnue.hpp"
+#include "movgen/generate.hpp"
 #include "scout.hpp"
 
 
@@ -13,6 +14,13 @@
 
 #include "zobrist.hpp"
 
+namespace {
+
+// in MB, up to 1 TB where size_t can address it
+constexpr int MAX_HASH_MB = sizeof(size_t) >= 8 ? 1 << 20 : 2048;
+
+} // namespace
+
 UCIContext::UCIContext()
     : board_(&si_)
 {
@@ -131,13 +139,17 @@ void UCIContext::parse_go_perft(std::istream &is) {
         return;
 
     auto start = timer::now();
-    uint64_t nodes = perft(board_, depth);
+    std::vector<PerftDivide> divide;
+    uint64_t nodes = perft(board_, depth, n_threads_, size_t(perft_hash_mb_), &divide);
     auto delta = timer::now() - start;
 
     // (nodes / (delta_ms / 1000) / 1'000'000
-    uint64_t mnps = nodes / (delta * 1'000);
+    uint64_t mnps = nodes / (std::max<TimePoint>(delta, 1) * 1'000);
 
-    sync_cout() << nodes << " nodes @ " << mnps << " mn/s\n";
+    auto cout = sync_cout();
+    for (const PerftDivide &d: divide)
+        cout << d.move << ": " << d.nodes << '\n';
+    cout << nodes << " nodes @ " << mnps << " mn/s\n";
 }
 
 void UCIContext::parse_setopt(std::istream &is) {
@@ -153,15 +165,66 @@ void UCIContext::parse_setopt(std::istream &is) {
         if (is >> t; t != "value") return;
 
         int value = -1;
-        if (is >> value && value > 0) {
+        if (is >> value && value > 0 && value <= MAX_HASH_MB) {
             search_.stop();
             search_.wait_for_completion();
-            g_tt.resize(value);
+
+            auto start = timer::now();
+            g_tt.resize(size_t(value));
+            auto delta = timer::now() - start;
+
+            sync_cout() << "info string Hash " << value << " MB, " 
+                << g_tt.huge_page_bytes() / (1024 * 1024) << " MB of it in 2 MB pages, "
+                << "allocated in " << delta << " ms\n";
+        }
+    } else if (name == "threads") {
+        if (is >> t; t != "value") return;
+
+        int value = -1;
+        if (is >> value && value > 0) {
+            search_.set_threads(value);
+            g_tt.set_threads(value);
+            n_threads_ = value;
         }
     } else if (name == "clear") {
         if (is >> t; t != "hash") return;
 
+        auto start = timer::now();
         g_tt.clear();
+        sync_cout() << "info string Hash cleared in " << timer::now() - start << " ms\n";
+    } else if (name == "hashfile") {
+        if (is >> t; t != "value") return;
+        if (!std::getline(is, t)) return;
+
+        const char* path = t.c_str();
+        while (*path && std::isspace(*path))
+            ++path;
+
+        hash_file_ = path;
+    } else if (name == "save") {
+        if (is >> t; t != "hash") return;
+
+        search_.stop();
+        search_.wait_for_completion();
+
+        bool ok = g_tt.save(hash_file_.c_str());
+        sync_cout() << "info string Hash " << (ok ? "" : "not ") 
+            << "saved to " << hash_file_ << "\n";
+    } else if (name == "load") {
+        if (is >> t; t != "hash") return;
+
+        search_.stop();
+        search_.wait_for_completion();
+
+        bool ok = g_tt.load(hash_file_.c_str());
+        sync_cout() << "info string Hash " << (ok ? "" : "not ") 
+            << "loaded from " << hash_file_ << "\n";
+    } else if (name == "perfthash") {
+        if (is >> t; t != "value") return;
+
+        int value = -1;
+        if (is >> value && value >= 0 && value <= MAX_HASH_MB)
+            perft_hash_mb_ = value;
     } else if (name == "multipv") {
         if (is >> t; t != "value") return;
 
@@ -177,13 +240,30 @@ void UCIContext::parse_setopt(std::istream &is) {
         while (*path && std::isspace(*path))
             ++path;
 
-        if (mini::load_parameters(path)) {
-            sync_cout() << "info string NNUE initialized from file " << path << "\n";
+        search_.stop();
+        search_.wait_for_completion();
+
+        auto start = timer::now();
+        if (mini::load_parameters(path, nnue_int8_)) {
+            sync_cout() << "info string NNUE initialized from file " << path 
+                << " in " << timer::now() - start << " ms\n";
             mini::refresh_accumulator(board_, si_.acc, WHITE);
             mini::refresh_accumulator(board_, si_.acc, BLACK);
         } else {
             sync_cout() << "info string Failed to initialize NNUE from file " << path << "\n";
         }
+    } else if (name == "int8nnue") {
+        if (is >> t; t != "value") return;
+        if (!(is >> t) || (t != "true" && t != "false")) return;
+
+        search_.stop();
+        search_.wait_for_completion();
+
+        nnue_int8_ = t == "true";
+        mini::use_int8(nnue_int8_);
+        mini::refresh_accumulator(board_, si_.acc, WHITE);
+        mini::refresh_accumulator(board_, si_.acc, BLACK);
+        sync_cout() << "info string nnue " << mini::kernels_name() << "\n";
     } else if (name == "moveoverhead") {
         if (is >> t; t != "value") return;
 
@@ -236,10 +316,17 @@ void UCIContext::print_info() {
     cout << "id name saturn 1.3\n" << "id author egormoroz\n"
         <<  "option name Ponder type check default false\n"
         <<  "option name clear hash type button\n"
+        <<  "option name save hash type button\n"
+        <<  "option name load hash type button\n"
+        <<  "option name HashFile type string default " << hash_file_ << "\n"
         <<  "option name multipv type spin default 1 min 1 max 256\n"
         <<  "option name evalfile type string default <builtin>\n"
+        <<  "option name Int8NNUE type check default false\n"
         << "option name Hash type spin default " 
-            << d::tt_size << " min 16 max 4096\n"
+            << d::tt_size << " min 16 max " << MAX_HASH_MB << "\n"
+        <<  "option name Threads type spin default 1 min 1 max 256\n"
+        <<  "option name PerftHash type spin default " 
+            << perft_hash_mb_ << " min 0 max " << MAX_HASH_MB << "\n"
         <<  "option name MoveOverhead type spin default "
             << d::move_overhead << " min 0 max 1000\n"
         <<  "option name bookfile type string default <disabled>\n";
@@ -251,6 +338,9 @@ void UCIContext::print_info() {
              << p.def << " min " << p.min << " max " << p.max << '\n';
     }
 
+    cout << "info string nnue " << mini::kernels_name() 
+        << " movegen " << generator_name() << '\n';
+
     cout << "uciok\n";
 }
 
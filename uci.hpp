@@ -2,6 +2,7 @@
 #define CLI_HPP
 
 #include <iostream>
+#include <string>
 #include "board/board.hpp"
 #include "searchstack.hpp"
 #include "search/searchworker.hpp"
@@ -28,9 +29,15 @@ private:
     StateInfo si_;
 
     int multipv_ = 1;
+    bool nnue_int8_ = false;
+    // go perft uses Threads too, and a table of its own rather than the TT
+    int n_threads_ = 1;
+    int perft_hash_mb_ = 16;
 
     Book book_;
     bool book_loaded_ = false;
+
+    std::string hash_file_ = "saturn.hash";
 };
 
 #endif